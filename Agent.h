@@ -7,12 +7,18 @@
 #include <type_traits>
 #include <algorithm>
 #include <set>
+#include <iomanip>
+#include <memory>
 
 #include "Common.h"
 #include "Board64.h"
 #include "Action.h"
 #include "Episode.h"
 #include "NTupleNetwork.h"
+#include "StageNetworks.h"
+#include "TranspositionTable.h"
+#include "SearchBudget.h"
+#include "ThreadPool.h"
 
 
 class Agent {
@@ -62,6 +68,59 @@ protected:
     };
 
     std::map<key, value> meta_;
+
+    /**
+     * where the agent's weight tables are allocated, from pages= and numa=, see WeightPlacement
+     */
+    WeightPlacement Placement() const {
+        WeightPlacement placement;
+        if (meta_.find("pages") != meta_.end()) placement.pages = meta_.at("pages").value;
+        if (meta_.find("numa") != meta_.end()) {
+            placement.interleave = meta_.at("numa").value == "interleave";
+            placement.replicate = meta_.at("numa").value == "replicate";
+        }
+
+        if (placement.pages != "4k" && placement.pages != "thp" && placement.pages != "hugetlb") {
+            std::cerr << "unknown page size: " << placement.pages << std::endl;
+            std::exit(-1);
+        }
+        return placement;
+    }
+    /**
+     * quant=int16, quant=fp16 or quant=sparse loads weights written by --quantize, for inference only
+     */
+    std::string WeightType() const {
+        return meta_.find("quant") != meta_.end() ? meta_.at("quant").value : "float";
+    }
+
+    /**
+     * lazy=0 loads every stage network up front instead of on first use, see StageNetworks
+     */
+    bool LazyLoad() const {
+        return meta_.find("lazy") == meta_.end() || meta_.at("lazy").value != "0";
+    }
+
+    /**
+     * verify=1 compares the checksums of a weight container before using it, which reads the whole file
+     */
+    bool VerifyWeights() const {
+        return meta_.find("verify") != meta_.end() && meta_.at("verify").value == "1";
+    }
+
+    /**
+     * budget_ms=<ms> searches each move by iterative deepening until its time is up, instead of to the depth
+     * ddepth gives for the max tile, see SearchBudget
+     */
+    double BudgetMs() const {
+        return meta_.find("budget_ms") != meta_.end() ? double(meta_.at("budget_ms")) : 0;
+    }
+
+    /**
+     * max_depth= caps the iterative deepening of budget_ms=
+     */
+    int MaxDepth(int otherwise) const {
+        return meta_.find("max_depth") != meta_.end() ? int(meta_.at("max_depth")) : otherwise;
+    }
 };
 
 class Player : public Agent {
@@ -90,8 +149,6 @@ class RandomEnvironment : public RandomAgent {
 
 public:
     RandomEnvironment(const std::string &args = "") : RandomAgent("name=randomevil role=environment " + args),
-                                                      positions_(
-                                                              {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}),
                                                       popup_(1, 3),
                                                       bag_({0, 4, 4, 4}) {}
 
@@ -101,34 +158,20 @@ public:
             player_action = Action::Slide(Action(last_move_code));
         }
 
-        switch (Action::Slide(player_action).event()) {
-            case 0:
-                positions_ = {12, 13, 14, 15};
-                break;
-            case 1:
-                positions_ = {0, 4, 8, 12};
-                break;
-            case 2:
-                positions_ = {0, 1, 2, 3};
-                break;
-            case 3:
-                positions_ = {3, 7, 11, 15};
-                break;
-            default:
-                positions_ = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
-                break;
-        }
-
         int hint = engine_() % 3 + 1;
         if (meta_.find("next_hint") != meta_.end() && int(meta_["next_hint"]) != -1) {
             hint = int(meta_["next_hint"]);
         }
 
-        std::shuffle(positions_.begin(), positions_.end(), engine_);
+        unsigned positions = board.EmptyMask() & PlacingMask(Action::Slide(player_action).event());
 
-        for (unsigned int position : positions_) {
-            int value = board.operator()(position);
-            if (value != 0) continue;
+        if (positions != 0) {
+            // pick one of the empty cells uniformly, then step to it through the set bits
+            int skip = std::uniform_int_distribution<int>(0, __builtin_popcount(positions) - 1)(engine_);
+            for (; skip > 0; skip--) {
+                positions &= positions - 1;
+            }
+            unsigned int position = __builtin_ctz(positions);
 
             total_generated_tiles_++;
 
@@ -173,7 +216,6 @@ public:
         for (int i = 1; i <= 3; i++) {
             bag_[i] = 4;
         }
-        positions_ = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
         std::string next_hint_notify = "next_hint=-1";
         notify(next_hint_notify);
         total_generated_tiles_ = n_bonus_tile_ = 0;
@@ -205,7 +247,6 @@ private:
     int n_bonus_tile_ = 0;
     int total_generated_tiles_ = 0;
     std::array<int, 4> bag_;
-    std::vector<unsigned int> positions_;
     std::uniform_int_distribution<int> popup_;
 };
 
@@ -213,17 +254,16 @@ class DareDevil : public RandomAgent {
 
 public:
     DareDevil(const std::string &args = "") : RandomAgent("name=devil role=environment " + args),
-                                              positions_({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}),
                                               popup_(1, 3),
                                               bag_({0, 4, 4, 4}),
-                                              depth_setting_(2) {
+                                              depth_setting_(2),
+                                              tuple_network_(3, WeightType(), Placement(), VerifyWeights()),
+                                              budget_(BudgetMs()), max_depth_(MaxDepth(16)) {
 
         if (meta_.find("ddepth") != meta_.end()) {
             depth_setting_ = int(meta_["ddepth"]);
         }
 
-        tuple_network_ = std::vector<NTupleNetwork>(3);
-
         if (meta_.find("load") != meta_.end()) {
             std::string file_name = meta_["load"].value;
             load(file_name);
@@ -245,27 +285,19 @@ public:
 
         int player_move = player_action.event();
 
-        int depth = 2;
-        if (depth_setting_ == 0) {
-            depth = 6;
-        } else if (depth_setting_ == 1) {
-	    if(max_tile <= 9) {
-		depth=6;
-	    }
-            else {
-		depth = 8;
-	    }
-        } else if (depth_setting_ == 2) {
-            if (max_tile <= 11) {
-                depth = 6;
-            } else if (max_tile <= 12) {
-                depth = 8;
-            } else {
-                depth = 10;
-            }
-        }
+        int depth = SearchDepth(max_tile);
+
+        // the next stage is loaded in the background once the max tile is two merges short of it
+        tuple_network_.Prefetch(StageOf(max_tile + 2));
 
-        std::pair<int, float> position_reward = MiniMax(0, board, player_move, bag_, hint, depth);
+        budget_.Start();
+        std::pair<int, float> position_reward;
+        if (budget_.Enabled()) {
+            position_reward = Deepen(board, player_move, bag_, hint, depth);
+        } else {
+            position_reward = Search(board, player_move, bag_, hint, depth);
+        }
+        budget_.Finish(depth);
 
         total_generated_tiles_++;
 
@@ -299,53 +331,357 @@ public:
         return Action::Place(position_reward.first, hint, next_hint);
     }
 
-    std::vector<int> GetPlacingPosition(int player_move) {
-        switch (player_move) {
-            case 0:
-                return {12, 13, 14, 15};
-            case 1:
-                return {0, 4, 8, 12};
-            case 2:
-                return {0, 1, 2, 3};
-            case 3:
-                return {3, 7, 11, 15};
-            default:
-                return {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    /**
+     * the depth ddepth searches a board with max_tile to
+     */
+    int SearchDepth(int max_tile) const {
+        int depth = 2;
+        if (depth_setting_ == 0) {
+            depth = 6;
+        } else if (depth_setting_ == 1) {
+	    if(max_tile <= 9) {
+		depth=6;
+	    }
+            else {
+		depth = 8;
+	    }
+        } else if (depth_setting_ == 2) {
+            if (max_tile <= 11) {
+                depth = 6;
+            } else if (max_tile <= 12) {
+                depth = 8;
+            } else {
+                depth = 10;
+            }
         }
+
+        return depth;
     }
 
     int GetTupleId(Board64 board) {
-        if (board.GetMaxTile() >= 13)
+        return StageOf(board.GetMaxTile());
+    }
+
+    static int StageOf(int max_tile) {
+        if (max_tile >= 13)
             return 2;
-        if (board.GetMaxTile() >= 12)
+        if (max_tile >= 12)
             return 1;
 
         return 0;
     }
 
+    /**
+     * the bytes each feature and stage network takes, mapped and resident, as property("memory"),
+     * the latency percentiles and depths of the moves of this episode as property("latency")
+     */
+    std::string property(const std::string &key) const override {
+        if (key == "memory") return tuple_network_.MemoryReport();
+        if (key == "latency") return budget_.Report();
+        return Agent::property(key);
+    }
+
+    // the nodes MiniMax and AlphaBeta visited since the agent was made
+    size_t Nodes() const { return nodes_; }
+
     float V(Board64 board, int hint, int id) {
         return tuple_network_[id].GetValue(board, hint);
     }
 
+    /**
+     * iterative deepening over the even depths from 2, until the budget runs out or max_depth
+     * every iteration searches the positions best first by the previous one (see SearchPositions); one cut by the
+     * deadline is used if it finished the previous best position, and takes the best of the positions it finished;
+     * an iteration is not started when it would take longer than the rest of the budget, expecting it to grow on
+     * the last as the last grew on the one before
+     * depth is set to the last iteration that finished
+     */
     std::pair<int, float>
-    MiniMax(int state, Board64 board, int player_move, std::array<int, 4> bag, int hint, int depth) {
+    Deepen(Board64 board, int player_move, std::array<int, 4> bag, int hint, int &depth) {
+        unsigned positions = board.EmptyMask() & PlacingMask(player_move);
+        depth = 2;
+        if (board.IsTerminal() || positions == 0) return MiniMax(0, board, player_move, bag, hint, depth);
+
+        if (hint <= 3) {
+            bag[hint]--;
+        }
+
+        if (is_empty(bag)) {
+            for (int i = 1; i <= 3; i++) {
+                bag[i] = 4;
+            }
+        }
+
+        std::array<int, 16> order;
+        int count = 0;
+        for (; positions != 0; positions &= positions - 1) order[count++] = __builtin_ctz(positions);
+        AgeHistory();
+
+        std::pair<int, float> best;
+        double last_time = 0, time_before = 0;
+        for (int next = 2; next == 2 || next <= max_depth_; next += 2) {
+            double start = budget_.Elapsed();
+            std::array<float, 16> values;
+            unsigned finished;
+            std::pair<int, float> found = SearchPositions(board, bag, hint, next, order.data(), count, values,
+                                                          finished);
+            if (budget_.Expired() && !(finished & (1u << order[0]))) break;
+
+            best = found;
+            if (budget_.Expired()) break;
+
+            depth = next;
+            std::stable_sort(order.begin(), order.begin() + count, [&values](int a, int b) {
+                return values[a] < values[b];
+            });
+            // a position may tie the best with a bound, the best goes first
+            auto first = std::find(order.begin(), order.begin() + count, best.first);
+            std::rotate(order.begin(), first, first + 1);
+
+            time_before = last_time;
+            last_time = budget_.Elapsed() - start;
+            double growth = time_before > 0 ? std::max(1.0, last_time / time_before) : 1.0;
+            if (budget_.Elapsed() + last_time * growth > budget_.budget_ms()) break;
+        }
+
+        return best;
+    }
+
+    /**
+     * the placement and value of MiniMax(0, board, player_move, bag, hint, depth), searched with alpha-beta,
+     * the positions ordered by their history
+     */
+    std::pair<int, float> Search(Board64 board, int player_move, std::array<int, 4> bag, int hint, int depth) {
+        unsigned positions = board.EmptyMask() & PlacingMask(player_move);
+        if (board.IsTerminal() || positions == 0 || depth == 0) {
+            return MiniMax(0, board, player_move, bag, hint, depth);
+        }
+
+        if (hint <= 3) {
+            bag[hint]--;
+        }
+
+        if (is_empty(bag)) {
+            for (int i = 1; i <= 3; i++) {
+                bag[i] = 4;
+            }
+        }
+
+        std::array<int, 16> order;
+        std::array<int, 16> scores;
+        int count = 0;
+        for (; positions != 0; positions &= positions - 1) {
+            int position = __builtin_ctz(positions);
+            scores[position] = history_[position][1] + history_[position][2] + history_[position][3];
+            order[count++] = position;
+        }
+        std::stable_sort(order.begin(), order.begin() + count, [&scores](int a, int b) {
+            return scores[a] > scores[b];
+        });
+        AgeHistory();
+
+        std::array<float, 16> values;
+        unsigned finished;
+        return SearchPositions(board, bag, hint, depth, order.data(), count, values, finished);
+    }
+
+    /**
+     * the root of MiniMax at depth: the positions order[0..count) in that order, each worth the least of its next
+     * hints (see AlphaBeta); returns the best of the positions whose search finished before the deadline
+     * a position is only searched for whether it beats the best so far: one that MiniMax tries before the best
+     * takes its place if it is not worse, one after it only if it is better, so ties go as in MiniMax and the
+     * placement and value are exactly those of MiniMax
+     * values gets the value of every finished position, exact for the best and a bound past the best for the others,
+     * finished has the bits of the finished positions
+     * bag is the bag after hint, as in the chance node of MiniMax
+     */
+    std::pair<int, float> SearchPositions(Board64 board, const std::array<int, 4> &bag, int hint, int depth,
+                                          const int *order, int count, std::array<float, 16> &values,
+                                          unsigned &finished) {
+        std::pair<int, float> best(-1, float(INT64_MAX));
+        finished = 0;
+        for (int i = 0; i < count; i++) {
+            int position = order[i];
+            float bound = best.first == -1 ? INFINITY
+                                           : position < best.first ? std::nextafter(best.second, INFINITY)
+                                                                   : best.second;
+            Board64 child = board;
+            reward_t reward = child.Place(position, hint);
+
+            float min_reward = INFINITY;
+            for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+                if (bag[next_hint] != 0) {
+                    float beta = std::min(bound, min_reward);
+                    float value = reward + AlphaBeta(1, child, -1, bag, next_hint, depth - 1, -INFINITY,
+                                                     Above(beta - reward));
+                    min_reward = std::min(min_reward, value);
+                }
+            }
+            if (budget_.Expired()) break;
+
+            values[position] = min_reward;
+            finished |= 1u << position;
+            if (min_reward < bound) best = std::make_pair(position, min_reward);
+        }
+
+        return best;
+    }
+
+    /**
+     * MiniMax with alpha-beta pruning, fail-soft: the value of the node if it lies strictly between alpha and beta,
+     * otherwise a bound on it at or past the one it crossed
+     * the children are tried killer first, the last child of this depth that cut its node off, then by history,
+     * how much the cut-offs of a child saved (see Cut)
+     * the window of a child is the window of its parent less the reward, rounded outward to the next float, so the
+     * rounding of reward + value cannot make a bound look like a value inside the window
+     */
+    float AlphaBeta(int state, Board64 board, int player_move, std::array<int, 4> bag, int hint, int depth,
+                    float alpha, float beta) {
+        nodes_++;
+        // out of time: the result is thrown away, the leaves and their parents always finish
+        if (depth >= 2 && budget_.Tick()) {
+            return 0;
+        }
+
+        if (state == 1 && depth != 0) { // Max node - before state
+            MoveSet moves = GenerateMoves(board);
+            if (moves.legal == 0) {
+                return 0;
+            }
+
+            std::array<int, 4> directions;
+            int count = 0;
+            for (int d = 0; d < 4; ++d) {
+                if (moves.legal & (1u << d)) directions[count++] = d;
+            }
+            Order(directions.data(), count, depth, [this](int d) { return direction_history_[d]; });
+
+            float max_reward = INT64_MIN;
+            for (int i = 0; i < count; ++i) {
+                int d = directions[i];
+                reward_t reward = moves.rewards[d];
+                float value = reward + AlphaBeta(1 - state, moves.afterstates[d], d, bag, hint, depth - 1,
+                                                 Below(alpha - reward), Above(beta - reward));
+                max_reward = std::max(max_reward, value);
+                if (max_reward >= beta) {
+                    Cut(d, depth, direction_history_[d]);
+                    break;
+                }
+                alpha = std::max(alpha, max_reward);
+            }
+
+            return max_reward;
+        }
+
         if (board.IsTerminal()) {
-            return std::make_pair(-1, 0);
+            return 0;
         }
 
         if (depth == 0) {
-            return std::make_pair(-1, V(board, hint, GetTupleId(board)));
+            return V(board, hint, GetTupleId(board));
+        }
+
+        // Chance node - after state
+        unsigned positions = board.EmptyMask() & PlacingMask(player_move);
+
+        if (hint <= 3) {
+            bag[hint]--;
         }
 
-        if (state == 1) { // Max node - before state
+        if (is_empty(bag)) {
+            for (int i = 1; i <= 3; i++) {
+                bag[i] = 4;
+            }
+        }
+
+        // the children are (position, next hint), as position * 4 + next hint
+        std::array<int, 48> children;
+        int count = 0;
+        for (; positions != 0; positions &= positions - 1) {
+            for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+                if (bag[next_hint] != 0) children[count++] = __builtin_ctz(positions) * 4 + next_hint;
+            }
+        }
+        Order(children.data(), count, depth, [this](int child) { return history_[child / 4][child % 4]; });
+
+        float min_reward = INT64_MAX;
+        for (int i = 0; i < count; ++i) {
+            Board64 child = board;
+            reward_t reward = child.Place(children[i] / 4, hint);
+            float value = reward + AlphaBeta(1 - state, child, -1, bag, children[i] % 4, depth - 1,
+                                             Below(alpha - reward), Above(beta - reward));
+            min_reward = std::min(min_reward, value);
+            if (min_reward <= alpha) {
+                Cut(children[i], depth, history_[children[i] / 4][children[i] % 4]);
+                break;
+            }
+            beta = std::min(beta, min_reward);
+        }
+
+        return min_reward;
+    }
+
+    static float Below(float x) { return std::nextafter(x, -INFINITY); }
+
+    static float Above(float x) { return std::nextafter(x, INFINITY); }
+
+    /**
+     * moves[0..count) of a node of depth, the killer of the depth first, then by score, in their order on ties
+     */
+    template<typename Score>
+    void Order(int *moves, int count, int depth, const Score &score) {
+        int killer = killers_[depth & 31];
+        std::stable_sort(moves, moves + count, [&](int a, int b) {
+            if ((a == killer) != (b == killer)) return a == killer;
+            return score(a) > score(b);
+        });
+    }
+
+    /**
+     * move cut off its node of depth: it becomes the killer of the depth and its history grows by the size of the
+     * subtree it saved, about depth^2
+     */
+    void Cut(int move, int depth, int &history) {
+        killers_[depth & 31] = move;
+        history += depth * depth;
+    }
+
+    /**
+     * the histories fade by half every move, the positions of the last moves count most
+     */
+    void AgeHistory() {
+        for (auto &position : history_) {
+            for (int &history : position) history /= 2;
+        }
+        for (int &history : direction_history_) history /= 2;
+    }
+
+    /**
+     * the full-width search, the reference AlphaBeta keeps to
+     */
+    std::pair<int, float>
+    MiniMax(int state, Board64 board, int player_move, std::array<int, 4> bag, int hint, int depth) {
+        nodes_++;
+        // out of time: the result is thrown away, the leaves and their parents always finish
+        if (depth >= 2 && budget_.Tick()) {
+            return std::make_pair(-1, 0);
+        }
+
+        if (state == 1 && depth != 0) { // Max node - before state
+            // one pass gives both the terminal check and the children
+            MoveSet moves = GenerateMoves(board);
+            if (moves.legal == 0) {
+                return std::make_pair(-1, 0);
+            }
+
             int direction = -1;
             float max_reward = INT64_MIN;
             for (int d = 0; d < 4; ++d) { //direction
-                Board64 child = board;
-                reward_t reward = child.Slide(d);
-                if (child == board) continue;
+                if ((moves.legal & (1u << d)) == 0) continue;
 
-                std::pair<int, float> direction_reward = MiniMax(1 - state, child, d, bag, hint, depth - 1);
+                reward_t reward = moves.rewards[d];
+                std::pair<int, float> direction_reward = MiniMax(1 - state, moves.afterstates[d], d, bag, hint,
+                                                                   depth - 1);
 
                 if (reward + direction_reward.second > max_reward) {
                     max_reward = reward + direction_reward.second;
@@ -354,65 +690,62 @@ public:
             }
 
             return std::make_pair(direction, max_reward);
-        } else {
-            int placing_position = -1;
-            float min_reward = INT64_MAX;
+        }
 
-            std::vector<int> positions = GetPlacingPosition(player_move);
+        if (board.IsTerminal()) {
+            return std::make_pair(-1, 0);
+        }
 
-            if (hint <= 3) {
-                bag[hint]--;
-            }
+        if (depth == 0) {
+            return std::make_pair(-1, V(board, hint, GetTupleId(board)));
+        }
 
-            if (is_empty(bag)) {
-                for (int i = 1; i <= 3; i++) {
-                    bag[i] = 4;
-                }
+        // Chance node - after state
+        int placing_position = -1;
+        float min_reward = INT64_MAX;
+
+        unsigned positions = board.EmptyMask() & PlacingMask(player_move);
+
+        if (hint <= 3) {
+            bag[hint]--;
+        }
+
+        if (is_empty(bag)) {
+            for (int i = 1; i <= 3; i++) {
+                bag[i] = 4;
             }
+        }
 
-            for (int position : positions) {
-                if (board(position) != 0) continue;
+        for (; positions != 0; positions &= positions - 1) {
+            int position = __builtin_ctz(positions);
 
-                Board64 child = board;
-                reward_t reward = child.Place(position, hint);
+            Board64 child = board;
+            reward_t reward = child.Place(position, hint);
 
-                for (int next_hint = 1; next_hint <= 3; ++next_hint) {
-                    if (bag[next_hint] != 0) {
-                        std::pair<int, float> direction_reward = MiniMax(1 - state, child, -1, bag, next_hint,
-                                                                         depth - 1);
+            for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+                if (bag[next_hint] != 0) {
+                    std::pair<int, float> direction_reward = MiniMax(1 - state, child, -1, bag, next_hint,
+                                                                     depth - 1);
 
-                        if (reward + direction_reward.second < min_reward) {
-                            min_reward = reward + direction_reward.second;
-                            placing_position = position;
-                        }
+                    if (reward + direction_reward.second < min_reward) {
+                        min_reward = reward + direction_reward.second;
+                        placing_position = position;
                     }
                 }
             }
-
-            return std::make_pair(placing_position, min_reward);
         }
+
+        return std::make_pair(placing_position, min_reward);
     }
 
     void load(std::string file_name) {
-        for (int i = 0; i < 3; ++i) {
-            std::string fn = file_name;
-            fn.insert(fn.size() - 4, std::to_string(i));
-
-            std::ifstream load_stream(fn.c_str(), std::ios::in | std::ios::binary);
-            if (!load_stream.is_open()) std::exit(-1);
-
-            tuple_network_[i].load(load_stream);
-            load_stream.close();
-
-            std::cout << "Loaded " << i << " tuple" << std::endl;
-        }
+        tuple_network_.Load(file_name, LazyLoad());
     }
 
     void OpenEpisode(const std::string &flag = "") override {
         for (int i = 1; i <= 3; i++) {
             bag_[i] = 4;
         }
-        positions_ = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
         last_move_code = -1;
         total_generated_tiles_ = n_bonus_tile_ = 0;
         next_hint_ = -1;
@@ -423,10 +756,12 @@ public:
         for (int i = 1; i <= 3; i++) {
             bag_[i] = 4;
         }
-        positions_ = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
         last_move_code = -1;
         total_generated_tiles_ = n_bonus_tile_ = 0;
         next_hint_ = -1;
+
+        if (budget_.Enabled()) std::clog << name() << ": " << budget_.Report() << std::endl;
+        budget_.Reset();
     };
 
 private:
@@ -457,9 +792,17 @@ private:
     int depth_setting_;
     int next_hint_ = -1;
     std::array<int, 4> bag_;
-    std::vector<unsigned int> positions_;
     std::uniform_int_distribution<int> popup_;
-    std::vector<NTupleNetwork> tuple_network_;
+    StageNetworks tuple_network_;
+    SearchBudget budget_;
+    int max_depth_;
+    size_t nodes_ = 0;
+
+    // move ordering of AlphaBeta: the killer of each depth (mod 32, for any max_depth), the history of each
+    // (position, next hint) and direction
+    std::array<int, 32> killers_ = {};
+    std::array<std::array<int, 4>, 16> history_ = {};
+    std::array<int, 4> direction_history_ = {};
 
     bool is_empty(std::array<int, 4> bag) {
         for (int i = 1; i <= 3; i++) {
@@ -476,10 +819,12 @@ class TdLambdaPlayer : public Player {
 public:
     TdLambdaPlayer(const std::string &args = "") : Player("name=fightme role=player " + args),
                                                    lambda_(0.5), learning_rate_(0.0025), tuple_size_(3),
-                                                   bag_({0, 4, 4, 4}), depth_setting_(0) {
-
-        tuple_network_ = std::vector<NTupleNetwork>(tuple_size_);
+                                                   bag_({0, 4, 4, 4}), depth_setting_(0),
+                                                   tuple_network_(3, WeightType(), Placement(), VerifyWeights()),
+                                                   budget_(BudgetMs()), max_depth_(MaxDepth(15)) {
 
+        // quant= picks the weight type, pages= and numa= place the tables (see WeightPlacement),
+        // lazy=0 loads all stages up front
         if (meta_.find("load") != meta_.end()) {
             std::string file_name = meta_["load"].value;
             load(file_name);
@@ -497,6 +842,17 @@ public:
             file_name_ = meta_["save"].value;
             std::cout << file_name_ << std::endl;
         }
+
+        // tt=<MB> keeps a transposition table of that size for Expectimax, see TranspositionTable
+        if (meta_.find("tt") != meta_.end() && int(meta_["tt"]) > 0) {
+            table_.reset(new TranspositionTable(size_t(meta_["tt"])));
+        }
+
+        // threads=N searches on N threads, see Fork; with numa=replicate the workers are pinned round-robin to the
+        // NUMA nodes and read the weights of their own node
+        int threads = meta_.find("threads") != meta_.end() ? std::max(1, int(meta_["threads"])) : 1;
+        if (threads > 1) pool_.reset(new ThreadPool(threads, Placement().replicate));
+        thread_stats_.resize(threads);
     };
 
     void OpenEpisode(const std::string &flag = "") override {
@@ -511,6 +867,9 @@ public:
             bag_[i] = 4;
         }
         last_move_code = -1;
+
+        if (budget_.Enabled()) std::clog << name() << ": " << budget_.Report() << std::endl;
+        budget_.Reset();
     };
 
     void decreaseLearningRate10Times() {
@@ -521,6 +880,9 @@ public:
         std::vector<Episode::Move> moves = episode.GetMoves();
         int id = 0;
 
+        // the stored values were searched with the old weights
+        if (table_) table_->Clear();
+
         for (unsigned i = 9; i < moves.size(); i += 2) {
             Board64 after_state(moves[i].board);
             Action::Place place(moves[i].code);
@@ -531,23 +893,81 @@ public:
             if (i + 2 < moves.size()) {
                 Board64 after_state_next = Board64(moves[i + 2].board);
 
-                tuple_network_[id].UpdateValue(after_state, hint,
-                                               learning_rate_ * (GetReward(i, moves) - V(after_state, hint, id)));
+                tuple_network_.Writable(id).UpdateValue(after_state, hint,
+                                         learning_rate_ * (GetReward(i, moves) - V(after_state, hint, id)));
             } else {
-                tuple_network_[id].UpdateValue(after_state, hint, learning_rate_ * (-V(after_state, hint, id)));
+                tuple_network_.Writable(id).UpdateValue(after_state, hint, learning_rate_ * (-V(after_state, hint, id)));
             }
         }
     }
 
     int GetTupleId(Board64 board) {
-        if (board.GetMaxTile() >= 13)
+        return StageOf(board.GetMaxTile());
+    }
+
+    static int StageOf(int max_tile) {
+        if (max_tile >= 13)
             return 2;
-        if (board.GetMaxTile() >= 12)
+        if (max_tile >= 12)
             return 1;
 
         return 0;
     }
 
+    /**
+     * the bytes each feature and stage network takes, mapped and resident, as property("memory"),
+     * the latency percentiles and depths of the moves of this episode as property("latency")
+     */
+    std::string property(const std::string &key) const override {
+        if (key == "memory") return tuple_network_.MemoryReport();
+        if (key == "latency") return budget_.Report();
+        if (key == "search") return SearchReport();
+        return Agent::property(key);
+    }
+
+    /**
+     * what the last search visited, see NewSearch
+     */
+    struct SearchStats {
+        size_t nodes = 0;
+        size_t probes = 0;
+        size_t hits = 0;
+    };
+
+    /**
+     * starts the statistics of a search and, with a transposition table, a new generation of its entries
+     */
+    void NewSearch() {
+        for (ThreadStats &thread : thread_stats_) thread.stats = SearchStats();
+        if (table_) table_->NewGeneration();
+    }
+
+    // the sum over the threads of the search
+    SearchStats LastSearch() const {
+        SearchStats stats;
+        for (const ThreadStats &thread : thread_stats_) {
+            stats.nodes += thread.stats.nodes;
+            stats.probes += thread.stats.probes;
+            stats.hits += thread.stats.hits;
+        }
+        return stats;
+    }
+
+    /**
+     * the nodes and transposition table hits of the last move, as property("search")
+     */
+    std::string SearchReport() const {
+        SearchStats stats = LastSearch();
+        std::stringstream report;
+        report << "nodes " << stats.nodes;
+        if (table_) {
+            report << ", table hits " << stats.hits << "/" << stats.probes << " ("
+                   << std::fixed << std::setprecision(1) << (stats.probes ? 100.0 * stats.hits / stats.probes : 0.0)
+                   << "%)";
+        }
+        return report.str();
+    }
+
     float GetReward(int t, std::vector<Episode::Move> moves) {
         reward_t reward = 0;
         float ld = 1;
@@ -593,6 +1013,9 @@ public:
             }
         }
 
+        // the next stage is loaded in the background once the max tile is two merges short of it
+        tuple_network_.Prefetch(StageOf(board.GetMaxTile() + 2));
+
         return Policy(board, hint);
     }
 
@@ -645,7 +1068,16 @@ public:
             }
         }
 
-        std::pair<int, float> direction_reward = Expectimax(1, board, -1, bag_, hint, depth);
+        NewSearch();
+        budget_.Start();
+        std::pair<int, float> direction_reward;
+        if (budget_.Enabled()) {
+            direction_reward = Deepen(board, bag_, hint, depth);
+        } else {
+            direction_reward = Expectimax(1, board, -1, bag_, hint, depth);
+        }
+        budget_.Finish(depth);
+
         if (direction_reward.first != -1) {
             Action::Slide slide(direction_reward.first);
 
@@ -655,123 +1087,395 @@ public:
         return Action();
     }
 
+    /**
+     * iterative deepening of Expectimax over the odd depths from 1, until the budget runs out or max_depth
+     * every iteration searches the moves best first by the previous one (see SearchMoves); one cut by the deadline
+     * is used if it finished the previous best move, and takes the best of the moves it finished; an iteration
+     * is not started when it would take longer than the rest of the budget, expecting it to grow on the last as
+     * the last grew on the one before
+     * with a transposition table, an iteration finds the nodes the iterations of the last move searched
+     * depth is set to the last iteration that finished
+     */
+    std::pair<int, float> Deepen(Board64 board, const std::array<int, 4> &bag, int hint, int &depth) {
+        MoveSet moves = GenerateMoves(board);
+        depth = 1;
+        if (moves.legal == 0) {
+            return std::make_pair(-1, 0);
+        }
+
+        std::array<int, 4> order = {0, 1, 2, 3};
+        std::pair<int, float> best;
+        double last_time = 0, time_before = 0;
+        for (int next = 1; next == 1 || next <= max_depth_; next += 2) {
+            double start = budget_.Elapsed();
+            std::array<float, 4> values;
+            unsigned finished = SearchMoves(moves, bag, hint, next, order, values);
+            if (budget_.Expired() && !(finished & (1u << order[0]))) break;
+
+            // compared in the order of Expectimax, so a finished iteration gives its move
+            best = std::make_pair(-1, float(INT64_MIN));
+            for (int d = 0; d < 4; ++d) {
+                if ((finished & (1u << d)) && values[d] > best.second) best = std::make_pair(d, values[d]);
+            }
+            if (budget_.Expired()) break;
+
+            depth = next;
+            std::stable_sort(order.begin(), order.end(), [&values, &moves](int a, int b) {
+                bool legal_a = moves.legal & (1u << a), legal_b = moves.legal & (1u << b);
+                return legal_a != legal_b ? legal_a : legal_a && values[a] > values[b];
+            });
+
+            time_before = last_time;
+            last_time = budget_.Elapsed() - start;
+            double growth = time_before > 0 ? std::max(1.0, last_time / time_before) : 1.0;
+            if (budget_.Elapsed() + last_time * growth > budget_.budget_ms()) break;
+        }
+
+        return best;
+    }
+
+    /**
+     * the root of Expectimax at depth, for Deepen: the legal moves in order, each worth its reward and the value
+     * of its after-state; returns the moves whose search finished before the deadline
+     */
+    unsigned SearchMoves(const MoveSet &moves, const std::array<int, 4> &bag, int hint, int depth,
+                         const std::array<int, 4> &order, std::array<float, 4> &values) {
+        unsigned finished = 0;
+        for (int d : order) {
+            if ((moves.legal & (1u << d)) == 0) continue;
+
+            reward_t reward = moves.rewards[d];
+            std::pair<int, float> direction_reward = Expectimax(0, moves.afterstates[d], d, bag, hint, depth - 1);
+            if (budget_.Expired()) break;
+
+            values[d] = reward + direction_reward.second;
+            finished |= 1u << d;
+        }
+
+        return finished;
+    }
+
     std::pair<int, float>
     Expectimax(int state, Board64 board, int player_move, std::array<int, 4> bag, int hint, int depth) {
-        if (board.IsTerminal()) {
+        SearchStats &stats = thread_stats_[pool_ ? pool_->WorkerIndex() : 0].stats;
+        stats.nodes++;
+        // out of time: the result is thrown away, the leaves and their parents always finish
+        if (depth >= 2 && budget_.Tick()) {
             return std::make_pair(-1, 0);
         }
+        if (state == 1 && depth != 0) { // Max node - before state
+            // one pass gives both the terminal check and the children
+            MoveSet moves = GenerateMoves(board);
+            if (moves.legal == 0) {
+                return std::make_pair(-1, 0);
+            }
 
-        if (depth == 0) {
-            return std::make_pair(-1, V(board, hint, GetTupleId(board)));
-        }
+            if (depth == 1) {
+                return LeafMax(moves, hint);
+            }
 
-        if (state == 1) { // Max node - before state
-            int direction = -1;
-            float max_reward = INT64_MIN;
-            for (int d = 0; d < 4; ++d) { //direction
-                Board64 child = board;
-                reward_t reward = child.Slide(d);
-                if (child == board) continue;
+            // a max node of depth 2 or more is worth a table lookup, the leaves of LeafMax are not
+            std::pair<int, float> stored;
+            if (table_) {
+                stats.probes++;
+                if (table_->Probe(board, bag, hint, depth, stored)) {
+                    stats.hits++;
+                    return stored;
+                }
+            }
 
-                std::pair<int, float> direction_reward = Expectimax(1 - state, child, d, bag, hint, depth - 1);
+            std::array<int, 4> directions;
+            int count = 0;
+            for (int d = 0; d < 4; ++d) {
+                if (moves.legal & (1u << d)) directions[count++] = d;
+            }
 
-                if (reward + direction_reward.second > max_reward) {
-                    max_reward = reward + direction_reward.second;
+            std::array<float, 4> values;
+            Fork(depth, count, [&](int i) {
+                int d = directions[i];
+                values[d] = Expectimax(1 - state, moves.afterstates[d], d, bag, hint, depth - 1).second;
+            });
+
+            int direction = -1;
+            float max_reward = INT64_MIN;
+            for (int i = 0; i < count; ++i) { //direction
+                int d = directions[i];
+                reward_t reward = moves.rewards[d];
+                if (reward + values[d] > max_reward) {
+                    max_reward = reward + values[d];
                     direction = d;
                 }
             }
 
+            if (table_ && !budget_.Expired()) {
+                table_->Store(board, bag, hint, depth, std::make_pair(direction, max_reward));
+            }
             return std::make_pair(direction, max_reward);
-        } else {
-            float score = 0;
-            int child_count = 0;
-            std::vector<int> positions = GetPlacingPosition(player_move);
+        }
 
-            if (hint <= 3) {
-                bag[hint]--;
+        if (board.IsTerminal()) {
+            return std::make_pair(-1, 0);
+        }
+
+        if (depth == 0) {
+            return std::make_pair(-1, V(board, hint, GetTupleId(board)));
+        }
+
+        // Chance node - after state
+        float score = 0;
+        int child_count = 0;
+        unsigned positions = board.EmptyMask() & PlacingMask(player_move);
+
+        if (hint <= 3) {
+            bag[hint]--;
+        }
+
+        if (is_empty(bag)) {
+            for (int i = 1; i <= 3; i++) {
+                bag[i] = 4;
             }
+        }
 
-            if (is_empty(bag)) {
-                for (int i = 1; i <= 3; i++) {
-                    bag[i] = 4;
+        if (depth == 1) {
+            return std::make_pair(-1, LeafAverage(board, positions, bag, hint));
+        }
+
+        unsigned hints = NextHints(bag);
+        std::array<int, 16> cells;
+        int count = 0;
+        for (; positions != 0; positions &= positions - 1) cells[count++] = __builtin_ctz(positions);
+
+        std::array<reward_t, 16> rewards;
+        std::array<std::array<float, 3>, 16> values;
+        Fork(depth, count, [&](int i) {
+            Board64 child = board;
+            rewards[i] = child.Place(cells[i], hint);
+
+            // the max nodes of the last ply only differ in their hint, they are evaluated together
+            if (depth == 2) {
+                LeafMax3(child, hints, values[i]);
+                return;
+            }
+            for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+                if (bag[next_hint] != 0) {
+                    values[i][next_hint - 1] = Expectimax(1 - state, child, -1, bag, next_hint, depth - 1).second;
+                }
+            }
+        });
+
+        // summed in the order of the children, whichever thread searched them
+        for (int i = 0; i < count; i++) {
+            for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+                if (bag[next_hint] != 0) {
+                    score += rewards[i];
+                    score += values[i][next_hint - 1];
+                    child_count++;
                 }
             }
+        }
 
-            for (int position : positions) {
-                if (board(position) != 0) continue;
+        return std::make_pair(-1, score / child_count);
+    }
 
-                Board64 child = board;
-                reward_t reward = child.Place(position, hint);
+    float V(Board64 board, int hint, int id) {
+        return tuple_network_[id].GetValue(board, hint);
+    }
 
-                for (int next_hint = 1; next_hint <= 3; ++next_hint) {
-                    if (bag[next_hint] != 0) {
-                        std::pair<int, float> direction_reward = Expectimax(1 - state, child, -1, bag, next_hint,
-                                                                            depth - 1);
+    // the nodes that fork their children into tasks with threads=
+    static const int split_depth = 4;
+
+    /**
+     * task(0..count), the children of a node of depth: forked on the thread pool with threads= if the node is at
+     * least split_depth deep, otherwise in order on this thread
+     * the tasks only write their own results, the node combines them in the order of the children afterwards, so
+     * the search returns exactly the serial result; a transposition table hit is the value a search would return
+     */
+    template<typename Task>
+    void Fork(int depth, int count, const Task &task) {
+        if (pool_ && depth >= split_depth && count > 1) {
+            pool_->ParallelFor(count, task);
+            return;
+        }
+        for (int i = 0; i < count; i++) task(i);
+    }
 
-                        score += reward;
-                        score += direction_reward.second;
-                        child_count++;
-                    }
-                }
+    /**
+     * a max node whose after-states are all leaves, which is where the odd depths of Policy end: the indices
+     * of every after-state are computed and prefetched before the first one is summed
+     * the after-states are compared in the order of Expectimax, so the move and its value are the same
+     */
+    std::pair<int, float> LeafMax(const MoveSet &moves, int hint) {
+        std::array<ValueNetwork::Indices, 4> index;
+        std::array<int, 4> id;
+        unsigned leaves = 0;
+
+        for (int d = 0; d < 4; ++d) {
+            // a terminal after-state is worth 0
+            if ((moves.legal & (1u << d)) == 0 || moves.afterstates[d].IsTerminal()) continue;
+
+            leaves |= 1u << d;
+            id[d] = GetTupleId(moves.afterstates[d]);
+            tuple_network_[id[d]].GetIndices(TupleInput(moves.afterstates[d], hint), index[d]);
+            tuple_network_[id[d]].Prefetch(index[d]);
+        }
+
+        int direction = -1;
+        float max_reward = INT64_MIN;
+        for (int d = 0; d < 4; ++d) {
+            if ((moves.legal & (1u << d)) == 0) continue;
+
+            reward_t reward = moves.rewards[d];
+            float value = (leaves & (1u << d)) ? tuple_network_[id[d]].GetValue(index[d]) : 0;
+            if (reward + value > max_reward) {
+                max_reward = reward + value;
+                direction = d;
             }
+        }
+
+        return std::make_pair(direction, max_reward);
+    }
 
-            return std::make_pair(-1, score / child_count);
+    /**
+     * bit h set for each next hint h the bag still holds
+     */
+    static unsigned NextHints(const std::array<int, 4> &bag) {
+        unsigned hints = 0;
+        for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+            if (bag[next_hint] != 0) hints |= 1u << next_hint;
         }
+        return hints;
     }
 
-    std::vector<int> GetPlacingPosition(int player_move) {
-        switch (player_move) {
-            case 0:
-                return {12, 13, 14, 15};
-            case 1:
-                return {0, 4, 8, 12};
-            case 2:
-                return {0, 1, 2, 3};
-            case 3:
-                return {3, 7, 11, 15};
-            default:
-                return {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    /**
+     * the max nodes of depth 1 on board, one for each next hint h in hints, into values[h - 1]
+     * they share their after-states, so the moves are generated once and each after-state is evaluated for all
+     * the hints at once (see ValueNetwork::GetValues3), its weights are fetched once instead of once per hint
+     * the values are compared as in LeafMax, so each is the value of Expectimax on that max node
+     */
+    void LeafMax3(Board64 board, unsigned hints, std::array<float, 3> &values) {
+        values.fill(0);
+        MoveSet moves = GenerateMoves(board);
+        if (moves.legal == 0) return;
+
+        std::array<ValueNetwork::Indices, 4> index;
+        std::array<int, 4> id;
+        std::array<std::array<float, 3>, 4> leaf_values;
+        unsigned leaves = 0;
+        for (int d = 0; d < 4; ++d) {
+            leaf_values[d].fill(0); // a terminal after-state is worth 0
+            if ((moves.legal & (1u << d)) == 0 || moves.afterstates[d].IsTerminal()) continue;
+
+            leaves |= 1u << d;
+            id[d] = GetTupleId(moves.afterstates[d]);
+            tuple_network_[id[d]].GetIndices(TupleInput(moves.afterstates[d], 1), index[d]);
+            tuple_network_[id[d]].Prefetch(index[d]);
+        }
+        for (unsigned rest = leaves; rest != 0; rest &= rest - 1) {
+            int d = __builtin_ctz(rest);
+            tuple_network_[id[d]].GetValues3(index[d], hints, leaf_values[d].data());
+        }
+
+        for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+            if ((hints & (1u << next_hint)) == 0) continue;
+
+            float max_reward = INT64_MIN;
+            for (int d = 0; d < 4; ++d) {
+                if ((moves.legal & (1u << d)) == 0) continue;
+
+                reward_t reward = moves.rewards[d];
+                float value = leaf_values[d][next_hint - 1];
+                if (reward + value > max_reward) max_reward = reward + value;
+            }
+            values[next_hint - 1] = max_reward;
         }
     }
 
-    float V(Board64 board, int hint, int id) {
-        return tuple_network_[id].GetValue(board, hint);
+    /**
+     * a chance node whose children are all leaves
+     * the children that stay in the stage of board are evaluated together from board (see ValueNetwork::GetValues,
+     * which also prefetches all their weights before summing any), the others one by one, all their hints at once
+     * the children are summed in the order of the recursion in Expectimax, so the average is the same
+     */
+    float LeafAverage(Board64 board, unsigned positions, const std::array<int, 4> &bag, int hint) {
+        std::array<Board64, 16> children, shared;
+        std::array<reward_t, 16> rewards;
+        std::array<int, 16> cells, shared_of;
+        std::array<std::array<float, 4>, 16> values;
+        int count = 0, shared_count = 0, id = GetTupleId(board);
+        unsigned hints = NextHints(bag);
+
+        for (; positions != 0; positions &= positions - 1, count++) {
+            cells[count] = __builtin_ctz(positions);
+            children[count] = board;
+            rewards[count] = children[count].Place(cells[count], hint);
+            values[count].fill(0); // a terminal child is worth 0
+            if (children[count].IsTerminal()) continue;
+
+            int child_id = GetTupleId(children[count]);
+            if (child_id == id) {
+                shared[shared_count] = children[count];
+                shared_of[shared_count++] = count;
+                continue;
+            }
+            tuple_network_[child_id].GetValues3(children[count], hints, values[count].data() + 1);
+        }
+
+        for (int next_hint = 1; next_hint <= 3 && shared_count > 0; ++next_hint) {
+            if (bag[next_hint] == 0) continue;
+
+            std::array<int, 16> shared_cells;
+            std::array<float, 16> shared_values;
+            for (int i = 0; i < shared_count; i++) shared_cells[i] = cells[shared_of[i]];
+            tuple_network_[id].GetValues(board, next_hint, shared.data(), shared_cells.data(), shared_count,
+                                         shared_values.data());
+            for (int i = 0; i < shared_count; i++) values[shared_of[i]][next_hint] = shared_values[i];
+        }
+
+        float score = 0;
+        int child_count = 0;
+        for (int i = 0; i < count; i++) {
+            for (int next_hint = 1; next_hint <= 3; ++next_hint) {
+                if (bag[next_hint] == 0) continue;
+
+                score += rewards[i];
+                score += values[i][next_hint];
+                child_count++;
+            }
+        }
+
+        return score / child_count;
     }
 
     void save() {
+        // a .tnw name saves every stage in one container (see WeightFile), any other the legacy stage files
+        if (file_name_.size() > 4 && file_name_.compare(file_name_.size() - 4, 4, ".tnw") == 0) {
+            bool saved = WeightFile::Write(file_name_, WeightType(), tuple_size_, [this](int i, std::ofstream &out) {
+                tuple_network_[i].save(out);
+                return bool(out);
+            });
+            if (!saved) std::exit(-1);
+            std::cout << "saved tuple_network to " << file_name_ << std::endl;
+            return;
+        }
+
         for (int i = 0; i < tuple_size_; ++i) {
-            std::string name = file_name_;
-            name.insert(name.size() - 4, std::to_string(i));
+            std::string name = LegacyStageFileName(file_name_, i);
 
-            std::ofstream save_stream(name.c_str(), std::ios::out | std::ios::binary);
+            // written next to the file and renamed over it, the old file may still be mapped
+            std::string temp_name = name + ".tmp";
+            std::ofstream save_stream(temp_name.c_str(), std::ios::out | std::ios::binary);
 
             if (!save_stream.is_open()) std::exit(-1);
 
             tuple_network_[i].save(save_stream);
             save_stream.close();
+            if (!save_stream || std::rename(temp_name.c_str(), name.c_str()) != 0) std::exit(-1);
             std::cout << "saved tuple_network " << i << std::endl;
         }
     }
 
     void load(std::string file_name) {
-        for (int i = 0; i < tuple_size_; ++i) {
-            std::string fn = file_name;
-
-            fn.insert(fn.size() - 4, std::to_string(i));
-
-            std::cout << "Loading " << fn << std::endl;
-
-            std::ifstream load_stream(fn.c_str(), std::ios::in | std::ios::binary);
-
-            if (!load_stream.is_open()) {
-                std::exit(-1);
-            }
-
-            tuple_network_[i].load(load_stream);
-            load_stream.close();
-
-            std::cout << "Loaded " << i << " tuple" << std::endl;
-        }
+        tuple_network_.Load(file_name, LazyLoad());
     }
 
 private:
@@ -781,7 +1485,19 @@ private:
     float lambda_;
 
     std::string file_name_;
-    std::vector<NTupleNetwork> tuple_network_;
+    StageNetworks tuple_network_;
+    std::unique_ptr<TranspositionTable> table_;
+    std::unique_ptr<ThreadPool> pool_;
+
+    // the counters of one thread of the search, 128 bytes apart: the vector only aligns them to 16 bytes, but the
+    // counters of two threads are still more than a 64 byte cache line apart
+    struct ThreadStats {
+        SearchStats stats;
+        char padding[128 - sizeof(SearchStats)];
+    };
+    std::vector<ThreadStats> thread_stats_;
+    SearchBudget budget_;
+    int max_depth_;
     std::array<int, 4> bag_;
 
 
@@ -0,0 +1,1038 @@
+//
+// Micro benchmarks for the board and the search
+// usage: ./threes --bench="<name> [key=value ...]"
+//
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Common.h"
+#include "Board64.h"
+#include "BoardBatch.h"
+#include "NTupleNetwork.h"
+#include "Agent.h"
+
+class Benchmark {
+public:
+    Benchmark(const std::string &args) {
+        std::stringstream ss(args);
+        ss >> name_;
+        for (std::string pair; ss >> pair;) {
+            meta_[pair.substr(0, pair.find('='))] = pair.substr(pair.find('=') + 1);
+        }
+    }
+
+    int Run() {
+        if (name_ == "slide") return Slide();
+        if (name_ == "batch") return Batch();
+        if (name_ == "value") return Value();
+        if (name_ == "search") return Search();
+        if (name_ == "quant") return Quant();
+        if (name_ == "pages") return Pages();
+        if (name_ == "sparse") return SparseTables();
+        if (name_ == "prefetch") return Prefetch();
+        if (name_ == "place") return Place();
+        if (name_ == "transposition") return Transposition();
+        if (name_ == "parallel") return Parallel();
+        if (name_ == "devil") return Devil();
+
+        std::cerr << "unknown benchmark: " << name_ << std::endl;
+        return 1;
+    }
+
+protected:
+    std::string Get(const std::string &key, const std::string &value) const {
+        auto it = meta_.find(key);
+        return it != meta_.end() ? it->second : value;
+    }
+
+    size_t Get(const std::string &key, size_t value) const {
+        auto it = meta_.find(key);
+        return it != meta_.end() ? std::stoull(it->second) : value;
+    }
+
+    static double Now() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration<double>(now).count();
+    }
+
+    static void Report(const std::string &what, double ops, double seconds) {
+        std::cout << std::left << std::setw(24) << what << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(12) << (ops / seconds / 1e6) << " M/s"
+                  << std::setw(10) << std::setprecision(3) << seconds << " s" << std::endl;
+    }
+
+    /**
+     * the cache misses of this thread while it is running, from perf_event_open (what perf stat counts)
+     * Read returns -1 where the kernel offers no hardware counters, e.g. in most virtual machines
+     */
+    class CacheMisses {
+    public:
+        CacheMisses() {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd_ = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        ~CacheMisses() {
+            if (fd_ >= 0) close(fd_);
+        }
+
+        void Start() {
+            if (fd_ < 0) return;
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        long long Read() {
+            long long count = -1;
+            if (fd_ < 0) return count;
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &count, sizeof(count)) != sizeof(count)) return -1;
+            return count;
+        }
+
+    private:
+        int fd_;
+    };
+
+    static void Report(const std::string &what, double ops, double seconds, long long misses) {
+        Report(what, ops, seconds);
+        std::cout << "  cache misses: ";
+        if (misses < 0) {
+            std::cout << "unavailable" << std::endl;
+        } else {
+            std::cout << std::fixed << std::setprecision(2) << misses / ops << " per evaluation" << std::endl;
+        }
+    }
+
+    /**
+     * collect boards from random games, so the benchmarks run on realistic positions
+     */
+    static std::vector<board_t> Boards(size_t n, unsigned seed) {
+        std::vector<board_t> boards;
+        boards.reserve(n);
+        std::mt19937 engine(seed);
+
+        while (boards.size() < n) {
+            Board64 board;
+            for (int i = 0; i < 9; i++) {
+                int position = engine() % 16;
+                if (board(position) == 0) board.Place(position, engine() % 3 + 1);
+            }
+
+            while (boards.size() < n) {
+                int direction = engine() % 4;
+                Board64 before = board;
+                board.Slide(direction);
+                if (board == before) {
+                    if (board.IsTerminal()) break;
+                    continue;
+                }
+
+                static const int edge[4][4] = {{12, 13, 14, 15}, {0, 4, 8, 12}, {0, 1, 2, 3}, {3, 7, 11, 15}};
+                for (int k = 0, i = engine() % 4; k < 4; k++, i = (i + 1) % 4) {
+                    if (board(edge[direction][i]) == 0) {
+                        board.Place(edge[direction][i], engine() % 3 + 1);
+                        break;
+                    }
+                }
+                boards.push_back(board.GetBoard());
+            }
+        }
+
+        return boards;
+    }
+
+#ifndef THREES_COMPACT_TABLES
+
+    /**
+     * the slide as it was before the fused move tables: plain XOR tables, then rescore the whole board
+     */
+    static reward_t LegacySlide(board_t &board, unsigned direction) {
+        board_t after = board;
+        board_t transpose_board = ::Transpose(board);
+
+        switch (direction & 0b11) {
+            case 0:
+                for (int i = 0; i < 4; i++)
+                    after ^= col_up_table[(transpose_board >> (16 * i)) & ROW_MASK] << (4 * i);
+                break;
+            case 1:
+                for (int i = 0; i < 4; i++)
+                    after ^= board_t(row_right_table[(board >> (16 * i)) & ROW_MASK]) << (16 * i);
+                break;
+            case 2:
+                for (int i = 0; i < 4; i++)
+                    after ^= col_down_table[(transpose_board >> (16 * i)) & ROW_MASK] << (4 * i);
+                break;
+            case 3:
+                for (int i = 0; i < 4; i++)
+                    after ^= board_t(row_left_table[(board >> (16 * i)) & ROW_MASK]) << (16 * i);
+                break;
+        }
+
+        reward_t reward = GetBoardScore(after) - GetBoardScore(board);
+        board = after;
+        return reward;
+    }
+
+#endif
+
+    /**
+     * slides/sec of the legacy slide against the fused move tables
+     * the legacy tables are not part of the compact build, there only the fused slide is timed
+     * options: n (number of boards), rounds, seed
+     */
+    int Slide() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 16)), Get("seed", size_t(0)));
+        size_t rounds = Get("rounds", size_t(64));
+        double ops = 4.0 * boards.size() * rounds;
+
+        board_t legacy_check = 0, fused_check = 0;
+        reward_t legacy_reward = 0, fused_reward = 0;
+
+        double start = Now();
+#ifndef THREES_COMPACT_TABLES
+        for (size_t r = 0; r < rounds; r++) {
+            for (board_t b : boards) {
+                for (unsigned d = 0; d < 4; d++) {
+                    board_t after = b;
+                    legacy_reward += LegacySlide(after, d);
+                    legacy_check ^= after;
+                }
+            }
+        }
+        Report("slide (legacy)", ops, Now() - start);
+#endif
+
+        std::vector<Board64> states(boards.begin(), boards.end());
+
+        start = Now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (const Board64 &b : states) {
+                for (unsigned d = 0; d < 4; d++) {
+                    Board64 after = b;
+                    fused_reward += after.Slide(d);
+                    fused_check ^= after.GetBoard();
+                }
+            }
+        }
+        Report("slide (fused)", ops, Now() - start);
+
+#ifdef THREES_COMPACT_TABLES
+        legacy_check = fused_check;
+        legacy_reward = fused_reward;
+#endif
+        if (legacy_check != fused_check || legacy_reward != fused_reward) {
+            std::cout << "mismatch between legacy and fused slides" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    /**
+     * per-board loop against the batched kernels for slide, place and max tile
+     * options: n (number of boards), rounds, seed
+     */
+    int Batch() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 12)), Get("seed", size_t(0)));
+        size_t n = boards.size();
+        size_t rounds = Get("rounds", size_t(1024));
+        double ops = 4.0 * n * rounds;
+        bool matched = true;
+
+        std::cout << "kernel: " << (HasAvx2() ? "avx2" : "scalar") << std::endl;
+
+        std::vector<board_t> scalar_out(n), batch_out(n);
+        std::vector<reward_t> scalar_rew(n), batch_rew(n);
+
+        double start = Now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (unsigned d = 0; d < 4; d++) SlideBatchScalar(&boards[0], &scalar_out[0], &scalar_rew[0], n, d);
+        }
+        Report("slide (per board)", ops, Now() - start);
+
+        start = Now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (unsigned d = 0; d < 4; d++) SlideBatch(&boards[0], &batch_out[0], &batch_rew[0], n, d);
+        }
+        Report("slide (batch)", ops, Now() - start);
+
+        for (unsigned d = 0; d < 4; d++) {
+            SlideBatchScalar(&boards[0], &scalar_out[0], &scalar_rew[0], n, d);
+            SlideBatch(&boards[0], &batch_out[0], &batch_rew[0], n, d);
+            matched &= scalar_out == batch_out && scalar_rew == batch_rew;
+        }
+
+        std::vector<unsigned> position(n);
+        std::vector<cell_t> tile(n);
+        for (size_t i = 0; i < n; i++) {
+            position[i] = (i * 7) % 17;
+            tile[i] = cell_t(i % 3 + 1);
+        }
+        ops = 1.0 * n * rounds;
+
+        start = Now();
+        for (size_t r = 0; r < rounds; r++) {
+            PlaceBatchScalar(&boards[0], &scalar_out[0], &scalar_rew[0], &position[0], &tile[0], n);
+        }
+        Report("place (per board)", ops, Now() - start);
+
+        start = Now();
+        for (size_t r = 0; r < rounds; r++) {
+            PlaceBatch(&boards[0], &batch_out[0], &batch_rew[0], &position[0], &tile[0], n);
+        }
+        Report("place (batch)", ops, Now() - start);
+        matched &= scalar_out == batch_out && scalar_rew == batch_rew;
+
+        std::vector<cell_t> scalar_max(n), batch_max(n);
+
+        start = Now();
+        for (size_t r = 0; r < rounds; r++) MaxTileBatchScalar(&boards[0], &scalar_max[0], n);
+        Report("max tile (per board)", ops, Now() - start);
+
+        start = Now();
+        for (size_t r = 0; r < rounds; r++) MaxTileBatch(&boards[0], &batch_max[0], n);
+        Report("max tile (batch)", ops, Now() - start);
+        matched &= scalar_max == batch_max;
+
+        if (!matched) {
+            std::cout << "mismatch between per-board and batched results" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    /**
+     * NTupleNetwork::GetValue evaluations/sec, then the cost of each of its stages
+     * options: load (a single stage weight file, zero weights if omitted), n, rounds, seed
+     */
+    int Value() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 12)), Get("seed", size_t(0)));
+        std::vector<Board64> states(boards.begin(), boards.end());
+        size_t rounds = Get("rounds", size_t(64));
+
+        std::unique_ptr<NTupleNetwork> network(new NTupleNetwork());
+        std::string load = Get("load", "");
+        if (load.size()) {
+            std::ifstream in(load, std::ios::in | std::ios::binary);
+            if (!in.is_open()) {
+                std::cerr << "cannot open " << load << std::endl;
+                return 1;
+            }
+            network->load(in);
+        }
+
+        float sum = 0;
+        double start = Now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < states.size(); i++) {
+                sum += network->GetValue(states[i], int(i % 3) + 1);
+            }
+        }
+        Report("GetValue", 1.0 * rounds * states.size(), Now() - start);
+        std::cout << "checksum " << sum << std::endl;
+
+        // the same evaluations one stage at a time over the whole set, so each stage is timed on its own
+        std::vector<TupleInput> inputs;
+        inputs.reserve(states.size());
+        std::vector<NTupleNetwork::Indices> indices(states.size());
+        double symmetry_time = 0, index_time = 0, fetch_time = 0;
+        float staged_sum = 0;
+
+        for (size_t r = 0; r < rounds; r++) {
+            inputs.clear();
+            start = Now();
+            for (size_t i = 0; i < states.size(); i++) {
+                inputs.emplace_back(states[i], int(i % 3) + 1);
+            }
+            symmetry_time += Now() - start;
+
+            start = Now();
+            for (size_t i = 0; i < states.size(); i++) {
+                network->GetIndices(inputs[i], indices[i]);
+            }
+            index_time += Now() - start;
+
+            start = Now();
+            for (size_t i = 0; i < states.size(); i++) {
+                staged_sum += network->GetValue(indices[i]);
+            }
+            fetch_time += Now() - start;
+        }
+
+        double total_time = symmetry_time + index_time + fetch_time;
+        double evaluations = 1.0 * rounds * states.size();
+        Report("  symmetry gen", evaluations, symmetry_time);
+        Report("  index calc", evaluations, index_time);
+        Report("  memory fetch", evaluations, fetch_time);
+        std::cout << std::setprecision(1)
+                  << "breakdown: symmetry gen " << 100 * symmetry_time / total_time
+                  << "%, index calc " << 100 * index_time / total_time
+                  << "%, memory fetch " << 100 * fetch_time / total_time << "%" << std::endl;
+
+        if (staged_sum != sum) {
+            std::cout << "mismatch between GetValue and the staged evaluation" << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    static float MaxNode(const Board64 &board, int depth, size_t &nodes) {
+        nodes++;
+        MoveSet moves = GenerateMoves(board);
+        float best = 0;
+        for (unsigned legal = moves.legal; legal != 0; legal &= legal - 1) {
+            int d = __builtin_ctz(legal);
+            best = std::max(best, moves.rewards[d] + ChanceNode(moves.afterstates[d], d, depth - 1, nodes));
+        }
+        return best;
+    }
+
+    static float ChanceNode(const Board64 &board, int player_move, int depth, size_t &nodes) {
+        nodes++;
+        unsigned positions = board.EmptyMask() & PlacingMask(player_move);
+        if (depth <= 0 || positions == 0) {
+            return GetBoardScore(board.GetBoard()) + board.GetMaxTile();
+        }
+
+        float sum = 0;
+        int count = 0;
+        for (; positions != 0; positions &= positions - 1) {
+            for (cell_t tile = 1; tile <= 3; tile++, count++) {
+                Board64 child = board;
+                reward_t reward = child.Place(__builtin_ctz(positions), tile);
+                sum += reward + MaxNode(child, depth - 1, nodes);
+            }
+        }
+        return sum / count;
+    }
+
+    /**
+     * search nodes/sec of a plain expectimax that walks the moves and placements like the agents do,
+     * with the board score as the leaf value, so it measures the board and its lookup tables without a tuple network
+     * options: n (number of root boards), depth (plies, default 5), seed
+     */
+    int Search() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 10)), Get("seed", size_t(0)));
+        int depth = int(Get("depth", size_t(5)));
+
+#ifdef THREES_COMPACT_TABLES
+        std::cout << "tables: compact, ";
+#else
+        std::cout << "tables: wide, ";
+#endif
+        std::cout << LookUpTableFootprint() / 1024 << " KB" << std::endl;
+
+        size_t nodes = 0;
+        float sum = 0;
+        double start = Now();
+        for (board_t b : boards) {
+            sum += MaxNode(Board64(b), depth, nodes);
+        }
+        Report("search nodes", nodes, Now() - start);
+        std::cout << "checksum " << sum << std::endl;
+
+        return 0;
+    }
+
+    template<typename Network>
+    static bool LoadNetwork(Network &network, const std::string &file_name) {
+        std::ifstream in(file_name, std::ios::in | std::ios::binary);
+        if (!in.is_open()) {
+            std::cerr << "cannot open " << file_name << std::endl;
+            return false;
+        }
+        network.load(in);
+        return bool(in);
+    }
+
+    struct GameStats {
+        double score = 0;
+        double moves = 0;
+        double seconds = 0;
+        std::array<size_t, 16> max_tile = {};
+    };
+
+    /**
+     * greedy games at ddepth=1: the player takes the move with the best reward plus afterstate value,
+     * the environment puts the hinted tile on a random cell of the opposite edge
+     */
+    template<typename Network>
+    static GameStats Play(Network &network, size_t games, unsigned seed) {
+        GameStats stats;
+        std::mt19937 engine(seed);
+
+        double start = Now();
+        for (size_t g = 0; g < games; g++) {
+            Board64 board;
+            for (int i = 0; i < 9; i++) {
+                int position = engine() % 16;
+                if (board(position) == 0) board.Place(position, engine() % 3 + 1);
+            }
+            int hint = engine() % 3 + 1;
+
+            for (MoveSet moves = GenerateMoves(board); moves.legal != 0; moves = GenerateMoves(board)) {
+                int best = -1;
+                float best_value = 0;
+                for (unsigned legal = moves.legal; legal != 0; legal &= legal - 1) {
+                    int d = __builtin_ctz(legal);
+                    float value = moves.rewards[d] + network.GetValue(moves.afterstates[d], hint);
+                    if (best == -1 || value > best_value) {
+                        best = d;
+                        best_value = value;
+                    }
+                }
+
+                board = moves.afterstates[best];
+                unsigned positions = board.EmptyMask() & PlacingMask(best);
+                for (int skip = engine() % __builtin_popcount(positions); skip > 0; skip--) {
+                    positions &= positions - 1;
+                }
+                board.Place(__builtin_ctz(positions), hint);
+                hint = engine() % 3 + 1;
+                stats.moves++;
+            }
+
+            stats.score += GetBoardScore(board.GetBoard());
+            stats.max_tile[board.GetMaxTile()]++;
+        }
+        stats.seconds = Now() - start;
+
+        return stats;
+    }
+
+    static void Report(const std::string &what, const GameStats &stats, size_t games) {
+        std::cout << std::left << std::setw(8) << what << std::right << std::fixed << std::setprecision(1)
+                  << " mean score " << std::setw(10) << stats.score / games
+                  << "   384+ " << std::setw(5) << 100.0 * ReachRate(stats, 10, games) << "%"
+                  << "   768+ " << std::setw(5) << 100.0 * ReachRate(stats, 11, games) << "%"
+                  << "   1536+ " << std::setw(5) << 100.0 * ReachRate(stats, 12, games) << "%"
+                  << std::setprecision(3) << "   " << stats.moves / stats.seconds / 1e3 << " K moves/s" << std::endl;
+    }
+
+    static double ReachRate(const GameStats &stats, int tile, size_t games) {
+        size_t reached = 0;
+        for (int t = tile; t < 16; t++) reached += stats.max_tile[t];
+        return double(reached) / games;
+    }
+
+    template<typename Network>
+    int Quant(const std::string &type) {
+        std::string load = Get("load", ""), qload = Get("qload", "");
+        std::unique_ptr<NTupleNetwork> network(new NTupleNetwork());
+        std::unique_ptr<Network> quantized(new Network());
+        if (!LoadNetwork(*network, load) || !LoadNetwork(*quantized, qload)) return 1;
+
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 16)), Get("seed", size_t(0)));
+        double abs_error = 0, max_error = 0, abs_value = 0;
+        for (size_t i = 0; i < boards.size(); i++) {
+            float value = network->GetValue(Board64(boards[i]), int(i % 3) + 1);
+            float error = std::fabs(quantized->GetValue(Board64(boards[i]), int(i % 3) + 1) - value);
+            abs_error += error;
+            abs_value += std::fabs(value);
+            max_error = std::max(max_error, double(error));
+        }
+        std::cout << std::scientific << std::setprecision(3)
+                  << "value error (" << type << " vs float): mean " << abs_error / boards.size()
+                  << ", max " << max_error << ", relative " << abs_error / abs_value << std::endl;
+
+        size_t games = Get("games", size_t(200));
+        unsigned seed = unsigned(Get("seed", size_t(0)));
+        GameStats float_stats = Play(*network, games, seed);
+        GameStats quant_stats = Play(*quantized, games, seed);
+        Report("float", float_stats, games);
+        Report(type, quant_stats, games);
+        std::cout << std::fixed << std::setprecision(1) << "delta: mean score "
+                  << (quant_stats.score - float_stats.score) / games
+                  << ", 768+ rate " << 100.0 * (ReachRate(quant_stats, 11, games) - ReachRate(float_stats, 11, games))
+                  << " points" << std::endl;
+
+        return 0;
+    }
+
+    /**
+     * value error and greedy (ddepth=1) game results of a quantized stage against the float one
+     * options: load (float single stage file), qload (the same stage written by --quantize), type (int16 or fp16),
+     *          n (boards for the value error), games, seed
+     */
+    int Quant() {
+        std::string type = Get("type", "int16");
+        if (type == "int16") return Quant<Int16TupleNetwork>(type);
+        if (type == "fp16") return Quant<Fp16TupleNetwork>(type);
+
+        std::cerr << "unknown weight type: " << type << std::endl;
+        return 1;
+    }
+
+    /**
+     * leaf evaluations/sec of one stage under each backing of its weight tables: the mapped file, then read into
+     * 4 KB pages, transparent huge pages and explicit huge pages (see WeightPlacement)
+     * every backing gets an untimed pass first, so the pages are in memory before the timed rounds
+     * options: load (float single stage file), numa (interleave), n, rounds, seed
+     */
+    int Pages() {
+        std::string load = Get("load", "");
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 16)), Get("seed", size_t(0)));
+        std::vector<Board64> states(boards.begin(), boards.end());
+        size_t rounds = Get("rounds", size_t(16));
+        float expected = 0;
+
+        for (std::string pages : {"file", "4k", "thp", "hugetlb"}) {
+            WeightPlacement placement;
+            placement.interleave = Get("numa", "") == "interleave";
+
+            ValueNetwork network;
+            if (pages == "file") {
+                if (!network.map(load, false)) {
+                    std::cerr << "cannot map " << load << std::endl;
+                    return 1;
+                }
+            } else {
+                placement.pages = pages;
+                network.Place(placement);
+                if (!LoadNetwork(network, load)) return 1;
+            }
+
+            float sum = 0;
+            for (size_t i = 0; i < states.size(); i++) sum += network.GetValue(states[i], int(i % 3) + 1);
+
+            double start = Now();
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < states.size(); i++) {
+                    sum += network.GetValue(states[i], int(i % 3) + 1);
+                }
+            }
+            Report("GetValue (" + pages + ")", 1.0 * rounds * states.size(), Now() - start);
+            std::cout << "  backing: " << Describe(network.Backing()) << std::endl;
+
+            if (pages != "file" && sum != expected) {
+                std::cout << "mismatch between the backings" << std::endl;
+                return 1;
+            }
+            expected = sum;
+        }
+
+        return 0;
+    }
+
+    /**
+     * leaf evaluations/sec and memory of a stage mapped dense against the same stage mapped sparse
+     * the values must be identical, a sparse table returns the very floats of the dense one
+     * options: load (float single stage file), sload (the same stage written by --quantize type=sparse), n, rounds,
+     *          seed
+     */
+    int SparseTables() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 16)), Get("seed", size_t(0)));
+        std::vector<Board64> states(boards.begin(), boards.end());
+        size_t rounds = Get("rounds", size_t(16));
+        float expected = 0;
+
+        for (std::string type : {"float", "sparse"}) {
+            std::string load = Get(type == "float" ? "load" : "sload", "");
+            ValueNetwork network(type);
+            if (!network.map(load, false)) {
+                std::cerr << "cannot map " << load << " as " << type << std::endl;
+                return 1;
+            }
+
+            float sum = 0;
+            for (size_t i = 0; i < states.size(); i++) sum += network.GetValue(states[i], int(i % 3) + 1);
+            float check = sum;
+
+            double start = Now();
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < states.size(); i++) {
+                    sum += network.GetValue(states[i], int(i % 3) + 1);
+                }
+            }
+            Report("GetValue (" + type + ")", 1.0 * rounds * states.size(), Now() - start);
+
+            size_t mapped = 0, resident = 0;
+            for (auto &feature : network.Memory()) {
+                mapped += feature.second.Bytes();
+                resident += feature.second.resident;
+            }
+            std::cout << std::fixed << std::setprecision(1) << "  memory: " << mapped / 1048576.0 << " MB mapped, "
+                      << resident / 1048576.0 << " MB resident" << std::endl;
+
+            if (type != "float" && check != expected) {
+                std::cout << "mismatch between dense and sparse values" << std::endl;
+                return 1;
+            }
+            expected = check;
+        }
+
+        return 0;
+    }
+
+    /**
+     * the weight fetches of an evaluation with and without prefetching all of its indices first, then the
+     * chance node pattern of Expectimax: the children of one node evaluated one by one, or their indices
+     * computed and prefetched together before any of them is summed
+     * options: load (a single stage weight file, zero weights if omitted), n, rounds, seed, siblings
+     */
+    int Prefetch() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 16)), Get("seed", size_t(0)));
+        std::vector<Board64> states(boards.begin(), boards.end());
+        size_t rounds = Get("rounds", size_t(8)), siblings = Get("siblings", size_t(12));
+
+        std::unique_ptr<NTupleNetwork> network(new NTupleNetwork());
+        std::string load = Get("load", "");
+        if (load.size() && !LoadNetwork(*network, load)) return 1;
+
+        CacheMisses misses;
+        double evaluations = 1.0 * rounds * states.size();
+        float expected = 0;
+        for (int prefetch = 0; prefetch < 2; prefetch++) {
+            float sum = 0;
+            misses.Start();
+            double start = Now();
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < states.size(); i++) {
+                    NTupleNetwork::Indices index;
+                    network->GetIndices(TupleInput(states[i], int(i % 3) + 1), index);
+                    if (prefetch) network->Prefetch(index);
+                    sum += network->GetValue(index);
+                }
+            }
+            Report(prefetch ? "prefetched" : "in order", evaluations, Now() - start, misses.Read());
+            if (prefetch && sum != expected) {
+                std::cout << "mismatch between the evaluations" << std::endl;
+                return 1;
+            }
+            expected = sum;
+        }
+
+        std::vector<NTupleNetwork::Indices> indices(siblings);
+        for (int batched = 0; batched < 2; batched++) {
+            float sum = 0;
+            misses.Start();
+            double start = Now();
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t first = 0; first + siblings <= states.size(); first += siblings) {
+                    if (!batched) {
+                        for (size_t i = first; i < first + siblings; i++) {
+                            sum += network->GetValue(states[i], int(i % 3) + 1);
+                        }
+                        continue;
+                    }
+                    for (size_t i = first; i < first + siblings; i++) {
+                        network->GetIndices(TupleInput(states[i], int(i % 3) + 1), indices[i - first]);
+                        network->Prefetch(indices[i - first]);
+                    }
+                    for (size_t i = first; i < first + siblings; i++) sum += network->GetValue(indices[i - first]);
+                }
+            }
+            Report(batched ? "siblings prefetched" : "siblings one by one", evaluations, Now() - start,
+                   misses.Read());
+            if (batched && sum != expected) {
+                std::cout << "mismatch between the evaluations" << std::endl;
+                return 1;
+            }
+            expected = sum;
+        }
+
+        return 0;
+    }
+
+    /**
+     * the leaves of a chance node: every child evaluated with GetValue, against GetValues, which evaluates the
+     * parent once and reads again only the weights on the placed cell of each child
+     * the children of a board are its placements of a tile on one of the edges it could have slid from,
+     * or on any empty cell with cells=all
+     * options: load (a single stage weight file, zero weights if omitted), n, rounds, seed, cells
+     */
+    int Place() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(1 << 14)), Get("seed", size_t(0)));
+        size_t rounds = Get("rounds", size_t(16));
+
+        std::unique_ptr<NTupleNetwork> network(new NTupleNetwork());
+        std::string load = Get("load", "");
+        if (load.size() && !LoadNetwork(*network, load)) return 1;
+
+        struct Node {
+            Board64 board;
+            int hint;
+            int count;
+            std::array<Board64, 16> children;
+            std::array<int, 16> cells;
+        };
+        std::vector<Node> nodes;
+        size_t children = 0;
+        bool all_cells = Get("cells", "edge") == "all";
+        for (size_t i = 0; i < boards.size(); i++) {
+            Node node;
+            node.board = Board64(boards[i]);
+            node.hint = int(i % 3) + 1;
+            node.count = 0;
+            for (unsigned positions = node.board.EmptyMask() & PlacingMask(all_cells ? -1 : int(i % 4)); positions != 0;
+                 positions &= positions - 1) {
+                node.cells[node.count] = __builtin_ctz(positions);
+                node.children[node.count] = node.board;
+                node.children[node.count++].Place(__builtin_ctz(positions), 1);
+            }
+            if (node.count == 0) continue;
+            nodes.push_back(node);
+            children += node.count;
+        }
+
+        std::array<float, 16> values;
+        float expected = 0;
+        for (int shared = 0; shared < 2; shared++) {
+            float sum = 0;
+            double start = Now();
+            for (size_t r = 0; r < rounds; r++) {
+                for (const Node &node : nodes) {
+                    if (shared) {
+                        network->GetValues(node.board, node.hint, node.children.data(), node.cells.data(), node.count,
+                                           values.data());
+                    } else {
+                        for (int i = 0; i < node.count; i++) values[i] = network->GetValue(node.children[i], node.hint);
+                    }
+                    for (int i = 0; i < node.count; i++) sum += values[i];
+                }
+            }
+            Report(shared ? "GetValues" : "GetValue per child", 1.0 * rounds * children, Now() - start);
+            if (shared && sum != expected) {
+                std::cout << "mismatch between GetValues and GetValue" << std::endl;
+                return 1;
+            }
+            expected = sum;
+        }
+        std::cout << std::fixed << std::setprecision(2) << 1.0 * children / nodes.size() << " children per node"
+                  << std::endl;
+
+        return 0;
+    }
+
+    /**
+     * the moves of one game searched twice by Expectimax, without and with a transposition table of tt MB,
+     * which must pick the same moves; per move the nodes searched, how many the table saved and its hit rate
+     * the environment puts the hinted tile on a random cell of the edge the board slid from
+     * options: load (weights as for --play, zero weights if omitted), depth, moves, seed, tt
+     */
+    int Transposition() {
+        std::string load = Get("load", "");
+        std::string args = load.size() ? "lazy=0 load=" + load : ""; // no stage loads in the timed searches
+        TdLambdaPlayer plain(args), cached(args + " tt=" + Get("tt", "64"));
+        int depth = int(Get("depth", size_t(5)));
+        size_t moves = Get("moves", size_t(100));
+        std::mt19937 engine(Get("seed", size_t(0)));
+
+        Board64 board;
+        for (int i = 0; i < 9; i++) {
+            int position = engine() % 16;
+            if (board(position) == 0) board.Place(position, engine() % 3 + 1);
+        }
+        std::array<int, 4> bag = {0, 4, 4, 4};
+        int hint = engine() % 3 + 1;
+
+        size_t plain_nodes = 0, cached_nodes = 0, probes = 0, hits = 0;
+        double plain_time = 0, cached_time = 0;
+        for (size_t move = 0; move < moves; move++) {
+            double start = Now();
+            plain.NewSearch();
+            std::pair<int, float> expected = plain.Expectimax(1, board, -1, bag, hint, depth);
+            double middle = Now();
+            cached.NewSearch();
+            std::pair<int, float> result = cached.Expectimax(1, board, -1, bag, hint, depth);
+            plain_time += middle - start;
+            cached_time += Now() - middle;
+
+            if (result != expected) {
+                std::cout << "move " << move << ": the table changed the search" << std::endl;
+                return 1;
+            }
+            if (expected.first == -1) break;
+
+            TdLambdaPlayer::SearchStats without = plain.LastSearch(), with = cached.LastSearch();
+            plain_nodes += without.nodes;
+            cached_nodes += with.nodes;
+            probes += with.probes;
+            hits += with.hits;
+            std::cout << "move " << std::setw(4) << move << std::setw(12) << without.nodes << " -> " << std::setw(10)
+                      << with.nodes << " nodes (" << std::fixed << std::setprecision(1) << std::setw(5)
+                      << 100.0 * (1.0 - 1.0 * with.nodes / without.nodes) << "% fewer), table hits "
+                      << with.hits << "/" << with.probes << " ("
+                      << (with.probes ? 100.0 * with.hits / with.probes : 0.0) << "%)" << std::endl;
+
+            board.Slide(expected.first);
+            unsigned positions = board.EmptyMask() & PlacingMask(expected.first);
+            for (int skip = engine() % __builtin_popcount(positions); skip > 0; skip--) positions &= positions - 1;
+            board.Place(__builtin_ctz(positions), hint);
+
+            bag[hint]--;
+            if (bag[1] + bag[2] + bag[3] == 0) bag = {0, 4, 4, 4};
+            do {
+                hint = engine() % 3 + 1;
+            } while (bag[hint] == 0);
+        }
+
+        std::cout << std::fixed << std::setprecision(1) << "total: " << plain_nodes << " -> " << cached_nodes
+                  << " nodes (" << 100.0 * (1.0 - 1.0 * cached_nodes / plain_nodes) << "% fewer), table hits "
+                  << hits << "/" << probes << " (" << (probes ? 100.0 * hits / probes : 0.0) << "%)" << std::endl;
+        std::cout << std::setprecision(3) << "search time: " << plain_time << " s without the table, "
+                  << cached_time << " s with it" << std::endl;
+
+        return 0;
+    }
+
+    /**
+     * Expectimax on the same boards with each thread count, which must give the serial moves and values;
+     * the time and the speedup over the first count, after an untimed pass that brings the weights into memory
+     * options: load (weights as for --play, zero weights if omitted), depth, n, seed, threads (a list, 1,2,4,...)
+     */
+    int Parallel() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(64)), Get("seed", size_t(0)));
+        int depth = int(Get("depth", size_t(7)));
+        std::string load = Get("load", "");
+        std::string args = load.size() ? "lazy=0 load=" + load : "";
+        std::stringstream counts(Get("threads", "1,2,4,8,16,32"));
+
+        std::vector<std::pair<int, float>> expected;
+        std::string first;
+        double serial_time = 0;
+        for (std::string count; std::getline(counts, count, ',');) {
+            TdLambdaPlayer player(args + " threads=" + count);
+            std::vector<std::pair<int, float>> results;
+            size_t nodes = 0;
+            if (first.empty()) {
+                for (size_t i = 0; i < boards.size(); i++) {
+                    std::array<int, 4> bag = {0, 4, 4, 4};
+                    player.Expectimax(1, Board64(boards[i]), -1, bag, int(i % 3) + 1, depth);
+                }
+            }
+
+            double start = Now();
+            for (size_t i = 0; i < boards.size(); i++) {
+                std::array<int, 4> bag = {0, 4, 4, 4};
+                player.NewSearch();
+                results.push_back(player.Expectimax(1, Board64(boards[i]), -1, bag, int(i % 3) + 1, depth));
+                nodes += player.LastSearch().nodes;
+            }
+            double seconds = Now() - start;
+
+            if (first.empty()) {
+                first = count;
+                expected = results;
+                serial_time = seconds;
+            } else if (results != expected) {
+                std::cout << count << " threads: the search differs from " << first << " threads" << std::endl;
+                return 1;
+            }
+            std::cout << std::setw(3) << count << " threads" << std::fixed << std::setprecision(3) << std::setw(10)
+                      << seconds << " s" << std::setprecision(2) << std::setw(8) << serial_time / seconds << "x"
+                      << std::setprecision(1) << std::setw(10) << nodes / seconds / 1e3 << " K nodes/s" << std::endl;
+        }
+        std::cout << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+        return 0;
+    }
+
+    /**
+     * the placements of the environment searched full width by MiniMax and by alpha-beta, which must pick the same
+     * position with the same value; the nodes and time of a move and the speedup at each depth a ddepth searches
+     * to (by the max tile, 6 to 10), on the same boards, after an untimed pass that brings the weights into memory
+     * each board is slid in its first legal direction from i % 4 and gets hint i % 3 + 1 from a full bag
+     * options: load (weights as for --play, zero weights if omitted), n, seed, ddepth (a list, 0,1,2)
+     */
+    int Devil() {
+        std::vector<board_t> boards = Boards(Get("n", size_t(8)), Get("seed", size_t(0)));
+        std::string load = Get("load", "");
+        std::string args = load.size() ? "lazy=0 load=" + load : "";
+        std::stringstream settings(Get("ddepth", "0,1,2"));
+
+        std::map<int, std::string> depths; // the ddepths that search to each depth
+        for (std::string setting; std::getline(settings, setting, ',');) {
+            DareDevil devil("ddepth=" + setting);
+            std::set<int> ladder;
+            for (int max_tile = 0; max_tile < 16; max_tile++) ladder.insert(devil.SearchDepth(max_tile));
+            for (int depth : ladder) depths[depth] += (depths[depth].empty() ? "" : ",") + setting;
+        }
+
+        std::vector<Board64> afterstates;
+        std::vector<int> directions;
+        for (size_t i = 0; i < boards.size(); i++) {
+            for (int k = 0; k < 4; k++) {
+                Board64 board(boards[i]);
+                int direction = int(i + k) % 4;
+                if (board.Slide(direction) == -1 || board.GetBoard() == boards[i]) continue;
+                afterstates.push_back(board);
+                directions.push_back(direction);
+                break;
+            }
+        }
+
+        DareDevil devil(args);
+        for (size_t i = 0; i < afterstates.size(); i++) {
+            std::array<int, 4> bag = {0, 4, 4, 4};
+            devil.Search(afterstates[i], directions[i], bag, int(i % 3) + 1, 2);
+        }
+
+        for (auto &depth : depths) {
+            size_t full_nodes = 0, pruned_nodes = 0;
+            double full_time = 0, pruned_time = 0;
+            for (size_t i = 0; i < afterstates.size(); i++) {
+                std::array<int, 4> bag = {0, 4, 4, 4};
+                int hint = int(i % 3) + 1;
+
+                size_t nodes = devil.Nodes();
+                double start = Now();
+                std::pair<int, float> expected = devil.MiniMax(0, afterstates[i], directions[i], bag, hint,
+                                                               depth.first);
+                double middle = Now();
+                full_nodes += devil.Nodes() - nodes;
+                nodes = devil.Nodes();
+                std::pair<int, float> result = devil.Search(afterstates[i], directions[i], bag, hint, depth.first);
+                full_time += middle - start;
+                pruned_time += Now() - middle;
+                pruned_nodes += devil.Nodes() - nodes;
+
+                if (result != expected) {
+                    std::cout << "depth " << depth.first << " board " << i << ": alpha-beta placed "
+                              << result.first << " (" << result.second << "), minimax " << expected.first << " ("
+                              << expected.second << ")" << std::endl;
+                    return 1;
+                }
+            }
+
+            double moves = afterstates.size();
+            std::cout << "depth " << depth.first << " (ddepth=" << depth.second << ")" << std::endl
+                      << std::fixed << std::setprecision(0) << "  minimax    " << std::setw(12)
+                      << full_nodes / moves << " nodes" << std::setprecision(3) << std::setw(12)
+                      << 1e3 * full_time / moves << " ms per move" << std::endl
+                      << std::setprecision(0) << "  alpha-beta " << std::setw(12) << pruned_nodes / moves << " nodes"
+                      << std::setprecision(3) << std::setw(12) << 1e3 * pruned_time / moves << " ms per move"
+                      << std::setprecision(1) << std::setw(8) << full_time / pruned_time << "x" << std::endl;
+        }
+
+        return 0;
+    }
+
+private:
+    std::string name_;
+    std::map<std::string, std::string> meta_;
+};
@@ -45,18 +45,130 @@ static board_t Transpose(board_t board) {
     return b1 | (b2 >> 24) | (b3 << 24);
 }
 
+/**
+ * mirror every row left to right, by swapping the nibbles of each byte and then the bytes of each row
+ */
+static board_t MirrorRows(board_t board) {
+    board = ((board & 0x0F0F0F0F0F0F0F0FULL) << 4) | ((board >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+    return ((board & 0x00FF00FF00FF00FFULL) << 8) | ((board >> 8) & 0x00FF00FF00FF00FFULL);
+}
+
+/**
+ * reverse the order of the rows, i.e. mirror the board top to bottom
+ */
+static board_t FlipRows(board_t board) {
+    board = (board << 32) | (board >> 32);
+    return ((board & 0x0000FFFF0000FFFFULL) << 16) | ((board >> 16) & 0x0000FFFF0000FFFFULL);
+}
+
+/**
+ * slide the four lines of a board that is kept in both layouts
+ * the lines are the rows of `board`, so they are the columns of `other`: a horizontal slide passes the
+ * row-major board first, a vertical slide passes the column-major one first
+ * `right` slides the lines toward the high nibble (right or down), otherwise toward the low one (left or up)
+ * each entry carries the delta and the score delta of its line, so no rescoring is needed
+ */
+#ifdef THREES_COMPACT_TABLES
+
+static reward_t SlideLines(board_t board, board_t other, bool right, board_t &after, board_t &other_after) {
+    // mirrored lines slide toward the low nibble, so both directions share one table
+    board_t lines = right ? MirrorRows(board) : board;
+    uint32_t l0 = line_meta_table[(lines >> 0) & ROW_MASK];
+    uint32_t l1 = line_meta_table[(lines >> 16) & ROW_MASK];
+    uint32_t l2 = line_meta_table[(lines >> 32) & ROW_MASK];
+    uint32_t l3 = line_meta_table[(lines >> 48) & ROW_MASK];
+
+    board_t delta = (board_t(l0 & ROW_MASK) << 0) | (board_t(l1 & ROW_MASK) << 16) |
+                    (board_t(l2 & ROW_MASK) << 32) | (board_t(l3 & ROW_MASK) << 48);
+    if (right) delta = MirrorRows(delta);
+
+    after = board ^ delta;
+    other_after = other ^ Transpose(delta);
+
+    return line_reward_values[(l0 >> 16) & 0xF] + line_reward_values[(l1 >> 16) & 0xF] +
+           line_reward_values[(l2 >> 16) & 0xF] + line_reward_values[(l3 >> 16) & 0xF];
+}
+
+#else
+
+static reward_t SlideLines(board_t board, board_t other, bool right, board_t &after, board_t &other_after) {
+    const LineMove *table = right ? line_right_move_table : line_left_move_table;
+    const LineMove &l0 = table[(board >> 0) & ROW_MASK];
+    const LineMove &l1 = table[(board >> 16) & ROW_MASK];
+    const LineMove &l2 = table[(board >> 32) & ROW_MASK];
+    const LineMove &l3 = table[(board >> 48) & ROW_MASK];
+
+    after = board ^ ((board_t(l0.delta) << 0) | (board_t(l1.delta) << 16) |
+                     (board_t(l2.delta) << 32) | (board_t(l3.delta) << 48));
+    other_after = other ^ ((l0.unpacked << 0) | (l1.unpacked << 4) | (l2.unpacked << 8) | (l3.unpacked << 12));
+
+    return l0.reward + l1.reward + l2.reward + l3.reward;
+}
+
+#endif
+
+/**
+ * bit d is set when Slide(d) would change the board
+ */
+static unsigned LegalMoves(board_t board, board_t transpose_board) {
+    unsigned rows = LineCanMove(row_t(board >> 0)) | LineCanMove(row_t(board >> 16)) |
+                    LineCanMove(row_t(board >> 32)) | LineCanMove(row_t(board >> 48));
+    unsigned cols = LineCanMove(row_t(transpose_board >> 0)) | LineCanMove(row_t(transpose_board >> 16)) |
+                    LineCanMove(row_t(transpose_board >> 32)) | LineCanMove(row_t(transpose_board >> 48));
+
+    // a column slides up where a row slides left, and down where a row slides right
+    return rows | (cols >> 3) | ((cols & 0b0010) << 1);
+}
+
+/**
+ * a 1 at bit 4i for every zero nibble i of the board, the others are 0
+ */
+static board_t ZeroNibbles(board_t board) {
+    board_t x = board | (board >> 1);
+    return ~(x | (x >> 2)) & 0x1111111111111111ULL;
+}
+
+/**
+ * cells where a tile may be placed after the player slid in `direction`, i.e. the opposite edge,
+ * or every cell when there is no previous slide
+ */
+static unsigned PlacingMask(int direction) {
+    switch (direction) {
+        case 0:
+            return 0xF000; // 12, 13, 14, 15
+        case 1:
+            return 0x1111; // 0, 4, 8, 12
+        case 2:
+            return 0x000F; // 0, 1, 2, 3
+        case 3:
+            return 0x8888; // 3, 7, 11, 15
+        default:
+            return 0xFFFF;
+    }
+}
+
+struct MoveSet;
+
+class Board64;
+
+static MoveSet GenerateMoves(const Board64 &board);
+
+static std::array<Board64, 8> Symmetries(const Board64 &board);
+
+/**
+ * the board is kept row-major in board_ and column-major in transpose_
+ * every mutation updates both, so vertical slides and column reads need no transpose
+ */
 class Board64 {
 public:
-    Board64() : board_() {}
+    Board64() : board_(), transpose_() {}
 
-    Board64(const board_t &board, const int hint = 0) : board_(board) {}
+    Board64(const board_t &board, const int hint = 0) : board_(board), transpose_(::Transpose(board)) {}
 
     Board64(const Board64 &board) = default;
 
     Board64 &operator=(const Board64 &b) = default;
 
-    explicit operator board_t &() { return board_; }
-
     explicit operator const board_t &() const { return board_; }
 
     row_t operator[](unsigned i) {
@@ -75,6 +187,10 @@ public:
         return board_;
     }
 
+    board_t GetTransposedBoard() const {
+        return transpose_;
+    }
+
     int operator()(int i) {
         int row_id = i / 4;
         int col_id = i % 4;
@@ -135,6 +251,7 @@ public:
         board_t after_place_board = board_ | cell;
         reward_t reward = GetReward(board_, after_place_board);
         board_ = after_place_board;
+        transpose_ |= board_t(tile) << ((col_id * 4 + row_id) * 4);
 
         return reward;
     }
@@ -163,61 +280,23 @@ public:
     }
 
     reward_t SlideLeft() {
-        board_t after_slide_board = board_;
-
-        after_slide_board ^= board_t(row_left_table[(board_ >> 0) & ROW_MASK]) << 0;
-        after_slide_board ^= board_t(row_left_table[(board_ >> 16) & ROW_MASK]) << 16;
-        after_slide_board ^= board_t(row_left_table[(board_ >> 32) & ROW_MASK]) << 32;
-        after_slide_board ^= board_t(row_left_table[(board_ >> 48) & ROW_MASK]) << 48;
-
-        reward_t reward = GetReward(board_, after_slide_board);
-        this->board_ = after_slide_board;
-
-        return reward;
+        return SlideLines(board_, transpose_, false, board_, transpose_);
     }
 
     reward_t SlideRight() {
-        board_t after_slide_board = board_;
-
-        after_slide_board ^= board_t(row_right_table[(board_ >> 0) & ROW_MASK]) << 0;
-        after_slide_board ^= board_t(row_right_table[(board_ >> 16) & ROW_MASK]) << 16;
-        after_slide_board ^= board_t(row_right_table[(board_ >> 32) & ROW_MASK]) << 32;
-        after_slide_board ^= board_t(row_right_table[(board_ >> 48) & ROW_MASK]) << 48;
-
-        reward_t reward = GetReward(board_, after_slide_board);
-        this->board_ = after_slide_board;
-
-        return reward;
+        return SlideLines(board_, transpose_, true, board_, transpose_);
     }
 
     reward_t SlideUp() {
-        board_t after_slide_board = board_;
-        board_t transpose_board = ::Transpose(board_);
-
-        after_slide_board ^= col_up_table[(transpose_board >> 0) & ROW_MASK] << 0;
-        after_slide_board ^= col_up_table[(transpose_board >> 16) & ROW_MASK] << 4;
-        after_slide_board ^= col_up_table[(transpose_board >> 32) & ROW_MASK] << 8;
-        after_slide_board ^= col_up_table[(transpose_board >> 48) & ROW_MASK] << 12;
-
-        reward_t reward = GetReward(board_, after_slide_board);
-        this->board_ = after_slide_board;
-
-        return reward;
+        return SlideLines(transpose_, board_, false, transpose_, board_);
     }
 
     reward_t SlideDown() {
-        board_t after_slide_board = board_;
-        board_t transpose_board = ::Transpose(board_);
-
-        after_slide_board ^= col_down_table[(transpose_board >> 0) & ROW_MASK] << 0;
-        after_slide_board ^= col_down_table[(transpose_board >> 16) & ROW_MASK] << 4;
-        after_slide_board ^= col_down_table[(transpose_board >> 32) & ROW_MASK] << 8;
-        after_slide_board ^= col_down_table[(transpose_board >> 48) & ROW_MASK] << 12;
-
-        reward_t reward = GetReward(board_, after_slide_board);
-        this->board_ = after_slide_board;
+        return SlideLines(transpose_, board_, true, transpose_, board_);
+    }
 
-        return reward;
+    unsigned LegalMoves() const {
+        return ::LegalMoves(board_, transpose_);
     }
 
 //    float GetHeuristicScore() {
@@ -226,17 +305,13 @@ public:
 //    }
 
     cell_t GetMaxTile() {
-        return std::max(row_max_table[(board_ >> 0) & ROW_MASK],
-                        std::max(row_max_table[(board_ >> 16) & ROW_MASK],
-                                 std::max(row_max_table[(board_ >> 32) & ROW_MASK],
-                                          row_max_table[(board_ >> 48) & ROW_MASK])));
+        return std::max(std::max(LineMaxTile(row_t(board_ >> 0)), LineMaxTile(row_t(board_ >> 16))),
+                        std::max(LineMaxTile(row_t(board_ >> 32)), LineMaxTile(row_t(board_ >> 48))));
     }
 
     cell_t GetMaxTile() const {
-        return std::max(row_max_table[(board_ >> 0) & ROW_MASK],
-                        std::max(row_max_table[(board_ >> 16) & ROW_MASK],
-                                 std::max(row_max_table[(board_ >> 32) & ROW_MASK],
-                                          row_max_table[(board_ >> 48) & ROW_MASK])));
+        return std::max(std::max(LineMaxTile(row_t(board_ >> 0)), LineMaxTile(row_t(board_ >> 16))),
+                        std::max(LineMaxTile(row_t(board_ >> 32)), LineMaxTile(row_t(board_ >> 48))));
     }
 
     row_t GetRow(int row) {
@@ -244,12 +319,12 @@ public:
     }
 
     row_t GetCol(int col) {
-        board_t transpose_board = ::Transpose(board_);
-        return row_t((transpose_board >> 16ULL * col) & ROW_MASK);
+        return row_t((transpose_ >> 16ULL * col) & ROW_MASK);
     }
 
     void SetRow(int row_id, row_t value) {
         board_ = (board_ ^ (board_t(GetRow(row_id)) << (16ULL * row_id))) | (board_t(value) << (16ULL * row_id));
+        transpose_ = ::Transpose(board_);
     }
 
     void Print() {
@@ -263,39 +338,109 @@ public:
         printf("\n");
     }
 
+    /**
+     * mirroring the rows of a board reverses the rows of its transpose
+     */
     void TurnRight() {
-        this->Transpose();
-        this->ReflectVertical();
+        board_t board = board_;
+        board_ = MirrorRows(transpose_);
+        transpose_ = FlipRows(board);
     }
 
     void ReflectVertical() {
-        for (int r = 0; r < 4; r++) {
-            this->ReverseRow(r);
-        }
+        board_ = MirrorRows(board_);
+        transpose_ = FlipRows(transpose_);
     }
 
     void Transpose() {
-        board_ = ::Transpose(this->board_);
+        std::swap(board_, transpose_);
     }
 
-    bool IsTerminal() {
-        for (int direction = 0; direction < 4; ++direction) {
-            Board64 temp_board = board_;
-            temp_board.Slide(direction);
-            if (temp_board != board_)
-                return false;
-        }
+    bool IsTerminal() const {
+        return LegalMoves() == 0;
+    }
 
-        return true;
+    /**
+     * bit i is set when cell i is empty, the flags of ZeroNibbles packed into 16 bits
+     */
+    unsigned EmptyMask() const {
+        board_t x = ZeroNibbles(board_);
+        x = (x | (x >> 3)) & 0x0303030303030303ULL;
+        x = (x | (x >> 6)) & 0x000F000F000F000FULL;
+        x = (x | (x >> 12)) & 0x000000FF000000FFULL;
+        return unsigned((x | (x >> 24)) & 0xFFFF);
     }
 
 private:
     board_t board_;
+    board_t transpose_;
+
+    Board64(board_t board, board_t transpose_board, bool) : board_(board), transpose_(transpose_board) {}
 
-    void ReverseRow(int row_id) {
-        row_t row = GetRow(row_id);
-        row = (row & 0xf000) >> 12 | (row & 0x0f00) >> 4 | (row & 0x00f0) << 4 | (row & 0x000f) << 12;
+    friend MoveSet GenerateMoves(const Board64 &board);
 
-        SetRow(row_id, row);
+    friend std::array<Board64, 8> Symmetries(const Board64 &board);
+};
+
+/**
+ * all four slides of a board at once
+ * afterstates[d] and rewards[d] are what Slide(d) gives, bit d of legal is set when that slide changes the board
+ */
+struct MoveSet {
+    Board64 afterstates[4];
+    reward_t rewards[4];
+    unsigned legal;
+};
+
+static MoveSet GenerateMoves(const Board64 &board) {
+    MoveSet moves;
+    board_t b = board.board_;
+    board_t t = board.transpose_;
+    board_t after[4] = {b, b, b, b};
+    board_t after_t[4] = {t, t, t, t};
+
+    moves.legal = LegalMoves(b, t);
+    moves.rewards[0] = (moves.legal & 0b0001) ? SlideLines(t, b, false, after_t[0], after[0]) : 0;
+    moves.rewards[1] = (moves.legal & 0b0010) ? SlideLines(b, t, true, after[1], after_t[1]) : 0;
+    moves.rewards[2] = (moves.legal & 0b0100) ? SlideLines(t, b, true, after_t[2], after[2]) : 0;
+    moves.rewards[3] = (moves.legal & 0b1000) ? SlideLines(b, t, false, after[3], after_t[3]) : 0;
+
+    for (int d = 0; d < 4; d++) {
+        moves.afterstates[d] = Board64(after[d], after_t[d], true);
     }
-};
\ No newline at end of file
+
+    return moves;
+}
+
+/**
+ * the 8 dihedral transforms of a board, in the order the tuple evaluators visit them:
+ * element 2i is the board turned right i times and element 2i+1 is that board reflected
+ *
+ * mirror (M) and flip (F) commute, and the transpose of every transform is another transform,
+ * so the 8 boards in both layouts come from 6 SWAR shuffles of the board (b) and its transpose (t)
+ */
+static std::array<Board64, 8> Symmetries(const Board64 &board) {
+    board_t b = board.board_, t = board.transpose_;
+    board_t mb = MirrorRows(b), fb = FlipRows(b), mfb = MirrorRows(fb);
+    board_t mt = MirrorRows(t), ft = FlipRows(t), mft = MirrorRows(ft);
+
+    return {{
+        Board64(b, t, true), Board64(mb, ft, true),
+        Board64(mt, fb, true), Board64(t, b, true),
+        Board64(mfb, mft, true), Board64(fb, mt, true),
+        Board64(ft, mb, true), Board64(mft, mfb, true)
+    }};
+}
+
+/**
+ * the smallest of the 8 symmetric boards, a representative shared by all of them
+ * inline rather than static: it is for callers outside the search (the search keys its table on the board as it
+ * is, a symmetric board may pick another direction and round its value otherwise), so a unit need not use it
+ */
+inline board_t Canonical(const Board64 &board) {
+    board_t b = board.GetBoard(), t = board.GetTransposedBoard();
+    board_t fb = FlipRows(b), ft = FlipRows(t);
+
+    return std::min(std::min(std::min(b, MirrorRows(b)), std::min(fb, MirrorRows(fb))),
+                    std::min(std::min(t, MirrorRows(t)), std::min(ft, MirrorRows(ft))));
+}
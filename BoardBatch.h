@@ -0,0 +1,271 @@
+//
+// Batched board stepping: apply the same kind of step to many independent boards at once
+//
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <immintrin.h>
+
+#include "Common.h"
+#include "Board64.h"
+
+/**
+ * the AVX2 kernels are compiled with a target attribute and picked at runtime,
+ * every entry point falls back to plain Board64 calls on hosts without AVX2
+ */
+static bool HasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+static void SlideBatchScalar(const board_t *in, board_t *out, reward_t *rew, size_t n, unsigned direction) {
+    bool right = (direction & 0b11) == 1 || (direction & 0b11) == 2;
+    board_t other;
+
+    // only the row-major result is wanted, so the column-major side of SlideLines is a scratch value
+    for (size_t i = 0; i < n; i++) {
+        if (direction & 1) {
+            rew[i] = SlideLines(in[i], 0, right, out[i], other);
+        } else {
+            board_t board = in[i];
+            rew[i] = SlideLines(::Transpose(board), board, right, other, out[i]);
+        }
+    }
+}
+
+static void PlaceBatchScalar(const board_t *in, board_t *out, reward_t *rew,
+                             const unsigned *position, const cell_t *tile, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Board64 board(in[i]);
+        rew[i] = board.Place(position[i], tile[i]);
+        out[i] = board.GetBoard();
+    }
+}
+
+static void MaxTileBatchScalar(const board_t *in, cell_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = Board64(in[i]).GetMaxTile();
+    }
+}
+
+__attribute__((target("avx2")))
+static __m256i Transpose4x64(__m256i x) {
+    __m256i a1 = _mm256_and_si256(x, _mm256_set1_epi64x(0xF0F00F0FF0F00F0FULL));
+    __m256i a2 = _mm256_and_si256(x, _mm256_set1_epi64x(0x0000F0F00000F0F0ULL));
+    __m256i a3 = _mm256_and_si256(x, _mm256_set1_epi64x(0x0F0F00000F0F0000ULL));
+    __m256i a = _mm256_or_si256(a1, _mm256_or_si256(_mm256_slli_epi64(a2, 12), _mm256_srli_epi64(a3, 12)));
+    __m256i b1 = _mm256_and_si256(a, _mm256_set1_epi64x(0xFF00FF0000FF00FFULL));
+    __m256i b2 = _mm256_and_si256(a, _mm256_set1_epi64x(0x00FF00FF00000000ULL));
+    __m256i b3 = _mm256_and_si256(a, _mm256_set1_epi64x(0x00000000FF00FF00ULL));
+    return _mm256_or_si256(b1, _mm256_or_si256(_mm256_srli_epi64(b2, 24), _mm256_slli_epi64(b3, 24)));
+}
+
+#ifdef THREES_COMPACT_TABLES
+
+__attribute__((target("avx2")))
+static __m256i MirrorRows4x64(__m256i x) {
+    const __m256i nibbles = _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FULL);
+    const __m256i bytes = _mm256_set1_epi64x(0x00FF00FF00FF00FFULL);
+    x = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(x, nibbles), 4),
+                        _mm256_and_si256(_mm256_srli_epi64(x, 4), nibbles));
+    return _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(x, bytes), 8),
+                           _mm256_and_si256(_mm256_srli_epi64(x, 8), bytes));
+}
+
+/**
+ * slide four boards with the compact tables: the lines are brought into row-major layout sliding toward
+ * the low nibble, one 32-bit gather per row fetches the entries, and the delta is turned back at the end
+ */
+__attribute__((target("avx2")))
+static void SlideBatchAvx2(const board_t *in, board_t *out, reward_t *rew, size_t n, unsigned direction) {
+    size_t i = 0;
+    bool vertical = (direction & 1) == 0;
+    bool right = (direction & 0b11) == 1 || (direction & 0b11) == 2;
+    const __m128i delta_mask = _mm_set1_epi32(0xFFFF);
+    const __m128i code_mask = _mm_set1_epi32(0xF);
+    const int *table = reinterpret_cast<const int *>(line_meta_table);
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i board = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        __m256i lines = vertical ? Transpose4x64(board) : board;
+        if (right) lines = MirrorRows4x64(lines);
+
+        __m256i delta = _mm256_setzero_si256();
+        __m128 reward = _mm_setzero_ps();
+        for (int r = 0; r < 4; r++) {
+            __m128i shift = _mm_cvtsi32_si128(16 * r);
+            __m256i index = _mm256_and_si256(_mm256_srl_epi64(lines, shift), _mm256_set1_epi64x(ROW_MASK));
+            __m128i entry = _mm256_i64gather_epi32(table, index, 4);
+            __m256i line_delta = _mm256_cvtepu32_epi64(_mm_and_si128(entry, delta_mask));
+            delta = _mm256_or_si256(delta, _mm256_sll_epi64(line_delta, shift));
+            __m128i code = _mm_and_si128(_mm_srli_epi32(entry, 16), code_mask);
+            reward = _mm_add_ps(reward, _mm_i32gather_ps(line_reward_values, code, 4));
+        }
+
+        if (right) delta = MirrorRows4x64(delta);
+        if (vertical) delta = Transpose4x64(delta);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_xor_si256(board, delta));
+        _mm_storeu_ps(rew + i, reward);
+    }
+
+    SlideBatchScalar(in + i, out + i, rew + i, n - i, direction);
+}
+
+#else
+
+/**
+ * slide one row (i = 0..3) of four boards: a single gather fetches the reward and the row delta,
+ * which sit next to each other in the high half of a LineMove entry
+ */
+__attribute__((target("avx2")))
+static void SlideRow4x64(__m256i board, const LineMove *table, int i, __m256i &after, __m128 &reward) {
+    const __m256i row_mask = _mm256_set1_epi64x(ROW_MASK);
+    const __m256i even_lanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    __m128i shift = _mm_cvtsi32_si128(16 * i);
+
+    __m256i index = _mm256_and_si256(_mm256_srl_epi64(board, shift), row_mask);
+    __m256i entry = _mm256_i64gather_epi64(reinterpret_cast<const long long *>(&table[0].reward),
+                                           _mm256_slli_epi64(index, 1), 8);
+    __m256i delta = _mm256_and_si256(_mm256_srli_epi64(entry, 32), row_mask);
+    after = _mm256_xor_si256(after, _mm256_sll_epi64(delta, shift));
+
+    __m256i rewards = _mm256_permutevar8x32_epi32(entry, even_lanes);
+    reward = _mm_add_ps(reward, _mm_castsi128_ps(_mm256_castsi256_si128(rewards)));
+}
+
+/**
+ * slide one column (i = 0..3) of four transposed boards with the unpacked deltas
+ */
+__attribute__((target("avx2")))
+static void SlideCol4x64(__m256i transpose_board, const LineMove *table, int i, __m256i &after, __m128 &reward) {
+    const __m256i row_mask = _mm256_set1_epi64x(ROW_MASK);
+
+    __m256i index = _mm256_and_si256(_mm256_srl_epi64(transpose_board, _mm_cvtsi32_si128(16 * i)), row_mask);
+    __m256i offset = _mm256_slli_epi64(index, 1);
+    __m256i delta = _mm256_i64gather_epi64(reinterpret_cast<const long long *>(&table[0].unpacked), offset, 8);
+    after = _mm256_xor_si256(after, _mm256_sll_epi64(delta, _mm_cvtsi32_si128(4 * i)));
+    reward = _mm_add_ps(reward, _mm256_i64gather_ps(&table[0].reward, offset, 8));
+}
+
+__attribute__((target("avx2")))
+static void SlideBatchAvx2(const board_t *in, board_t *out, reward_t *rew, size_t n, unsigned direction) {
+    size_t i = 0;
+    bool vertical = (direction & 1) == 0;
+    // up and left slide their lines toward the low nibble, right and down toward the high one
+    const LineMove *table = (direction & 0b11) == 0 || (direction & 0b11) == 3 ?
+                            line_left_move_table : line_right_move_table;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i board = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        __m256i after = board;
+        __m128 reward = _mm_setzero_ps();
+
+        if (vertical) {
+            __m256i transpose_board = Transpose4x64(board);
+            for (int c = 0; c < 4; c++) SlideCol4x64(transpose_board, table, c, after, reward);
+        } else {
+            for (int r = 0; r < 4; r++) SlideRow4x64(board, table, r, after, reward);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), after);
+        _mm_storeu_ps(rew + i, reward);
+    }
+
+    SlideBatchScalar(in + i, out + i, rew + i, n - i, direction);
+}
+
+#endif
+
+__attribute__((target("avx2")))
+static void PlaceBatchAvx2(const board_t *in, board_t *out, reward_t *rew,
+                           const unsigned *position, const cell_t *tile, size_t n) {
+    size_t i = 0;
+    const __m256i row_mask = _mm256_set1_epi64x(ROW_MASK);
+
+    for (; i + 4 <= n; i += 4) {
+        int tiles;
+        std::memcpy(&tiles, tile + i, sizeof(tiles));
+
+        __m256i board = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        __m256i pos = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(position + i)));
+        __m256i cell = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(tiles));
+        __m256i valid = _mm256_cmpgt_epi64(_mm256_set1_epi64x(16), pos);
+
+        // shifts of 64 or more give zero, so an invalid position leaves the board untouched
+        __m256i after = _mm256_or_si256(board, _mm256_sllv_epi64(cell, _mm256_slli_epi64(pos, 2)));
+
+        // only the row holding the placed cell changes its score
+        __m256i row_shift = _mm256_slli_epi64(_mm256_srli_epi64(pos, 2), 4);
+        __m256i row_before = _mm256_and_si256(_mm256_srlv_epi64(board, row_shift), row_mask);
+        __m256i row_after = _mm256_and_si256(_mm256_srlv_epi64(after, row_shift), row_mask);
+        __m128 reward = _mm_sub_ps(_mm256_i64gather_ps(score_table, row_after, 4),
+                                   _mm256_i64gather_ps(score_table, row_before, 4));
+
+        __m128i valid32 = _mm256_castsi256_si128(
+                _mm256_permutevar8x32_epi32(valid, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+        reward = _mm_blendv_ps(_mm_set1_ps(-1), reward, _mm_castsi128_ps(valid32));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), after);
+        _mm_storeu_ps(rew + i, reward);
+    }
+
+    PlaceBatchScalar(in + i, out + i, rew + i, position + i, tile + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void MaxTileBatchAvx2(const board_t *in, cell_t *out, size_t n) {
+    size_t i = 0;
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i board = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        __m256i m = _mm256_max_epu8(_mm256_and_si256(board, nibble_mask),
+                                    _mm256_and_si256(_mm256_srli_epi64(board, 4), nibble_mask));
+        m = _mm256_max_epu8(m, _mm256_srli_epi64(m, 32));
+        m = _mm256_max_epu8(m, _mm256_srli_epi64(m, 16));
+        m = _mm256_max_epu8(m, _mm256_srli_epi64(m, 8));
+
+        alignas(32) board_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), m);
+        for (int k = 0; k < 4; k++) out[i + k] = cell_t(lanes[k]);
+    }
+
+    MaxTileBatchScalar(in + i, out + i, n - i);
+}
+
+/**
+ * slide n boards in the same direction, out[i] and rew[i] match Board64(in[i]).Slide(direction)
+ * in and out may be the same array
+ */
+static void SlideBatch(const board_t *in, board_t *out, reward_t *rew, size_t n, unsigned direction) {
+    if (HasAvx2()) {
+        SlideBatchAvx2(in, out, rew, n, direction);
+    } else {
+        SlideBatchScalar(in, out, rew, n, direction);
+    }
+}
+
+/**
+ * place tile[i] at position[i] on each of n boards, matching Board64::Place
+ */
+static void PlaceBatch(const board_t *in, board_t *out, reward_t *rew,
+                       const unsigned *position, const cell_t *tile, size_t n) {
+    if (HasAvx2()) {
+        PlaceBatchAvx2(in, out, rew, position, tile, n);
+    } else {
+        PlaceBatchScalar(in, out, rew, position, tile, n);
+    }
+}
+
+/**
+ * max tile of each of n boards, matching Board64::GetMaxTile
+ */
+static void MaxTileBatch(const board_t *in, cell_t *out, size_t n) {
+    if (HasAvx2()) {
+        MaxTileBatchAvx2(in, out, n);
+    } else {
+        MaxTileBatchScalar(in, out, n);
+    }
+}
@@ -13,16 +13,9 @@
 #include <cstring>
 #include <ctime>
 #include <algorithm>
+#include <memory>
 
-#include "Board64.h"
-
-static cell_t row_max_table[65536];
-static row_t row_left_table[65536];
-static row_t row_right_table[65536];
-static board_t col_up_table[65536];
-static board_t col_down_table[65536];
-static float heur_score_table[65536];
-static float score_table[65536];
+#include "Common.h"
 
 // Heuristic scoring settings
 static float SCORE_LOST_PENALTY = 200000.0f;
@@ -42,7 +35,75 @@ static row_t reverse_row(row_t row) {
     return (row >> 12) | ((row >> 4) & 0x00F0) | ((row << 4) & 0x0F00) | (row << 12);
 }
 
-void InitLookUpTables() {
+/**
+ * fused slide entry of a 16-bit line: the XOR delta that slides it and the score the slide gains
+ * the delta is kept both as a row and unpacked into column layout, because a line that is a row
+ * of the board is a column of its transpose and the other way round
+ */
+struct LineMove {
+    board_t unpacked;
+    reward_t reward;
+    row_t delta;
+};
+
+/**
+ * score deltas a single line slide can give: a line merges at most one pair, and the gain of a merge into
+ * rank k is 3^(k-2), except for two 15s, which stay 15 and lose one of them
+ * the compact line entries keep a 4-bit index into this array instead of the float
+ */
+static const reward_t line_reward_values[16] = {
+        0.0f, 3.0f, 9.0f, 27.0f, 81.0f, 243.0f, 729.0f, 2187.0f, 6561.0f, 19683.0f, 59049.0f, 177147.0f,
+        531441.0f, -1594323.0f, 0.0f, 0.0f
+};
+
+/**
+ * X-macro listing every lookup table as (type, name)
+ * the tables are generated once by TableGen.cpp at build time and baked into LookUpTableData.h
+ *
+ * with THREES_COMPACT_TABLES only score_table and a 32-bit line_meta_table are baked (512 KB instead of 3968 KB),
+ * an entry of line_meta_table holds, for the line as its index:
+ *   bits  0-15  XOR delta of sliding it toward the low nibble (left, or up for a column)
+ *   bits 16-19  index of the reward of that slide in line_reward_values
+ *   bits 20-23  max tile
+ *   bit  25     can slide toward the high nibble
+ *   bit  27     can slide toward the low nibble
+ * a slide toward the high nibble is the same entry looked up for the reversed line, and the column layout
+ * of a delta is its transpose, computed at use
+ */
+#define THREES_WIDE_LOOKUP_TABLES(X)   \
+    X(cell_t,   row_max_table)         \
+    X(row_t,    row_left_table)        \
+    X(row_t,    row_right_table)       \
+    X(board_t,  col_up_table)          \
+    X(board_t,  col_down_table)        \
+    X(float,    heur_score_table)      \
+    X(float,    score_table)           \
+    X(LineMove, line_left_move_table)  \
+    X(LineMove, line_right_move_table) \
+    X(cell_t,   row_can_move_table)
+
+#define THREES_COMPACT_LOOKUP_TABLES(X) \
+    X(float,    score_table)            \
+    X(uint32_t, line_meta_table)
+
+#ifdef THREES_COMPACT_TABLES
+#define THREES_LOOKUP_TABLES(X) THREES_COMPACT_LOOKUP_TABLES(X)
+#else
+#define THREES_LOOKUP_TABLES(X) THREES_WIDE_LOOKUP_TABLES(X)
+#endif
+
+/**
+ * a full set of lookup tables of both modes filled at runtime by GenerateLookUpTables
+ * only used by the table generator and by the self-check of the baked tables
+ */
+struct LookUpTableSet {
+#define THREES_DECLARE_TABLE(type, name) type name[65536];
+    THREES_WIDE_LOOKUP_TABLES(THREES_DECLARE_TABLE)
+#undef THREES_DECLARE_TABLE
+    uint32_t line_meta_table[65536];
+};
+
+static void GenerateLookUpTables(LookUpTableSet &t) {
     for(unsigned row = 0; row < 65536; ++row) {
         unsigned line[4] = {
                 (row >>  0) & 0xf,
@@ -59,8 +120,8 @@ void InitLookUpTables() {
                 score += powf(3, rank-2);
             }
         }
-        score_table[row] = score;
-        row_max_table[row] = std::max(std::max(line[0], line[1]), std::max(line[2], line[3]));
+        t.score_table[row] = score;
+        t.row_max_table[row] = std::max(std::max(line[0], line[1]), std::max(line[2], line[3]));
 
 
         // Heuristic score
@@ -99,11 +160,11 @@ void InitLookUpTables() {
             }
         }
 
-        heur_score_table[row] = SCORE_LOST_PENALTY
-                                + SCORE_EMPTY_WEIGHT * empty
-                                + SCORE_MERGES_WEIGHT * merges
-                                - SCORE_MONOTONICITY_WEIGHT * std::min(monotonicity_left, monotonicity_right)
-                                - SCORE_SUM_WEIGHT * sum;
+        t.heur_score_table[row] = SCORE_LOST_PENALTY
+                                  + SCORE_EMPTY_WEIGHT * empty
+                                  + SCORE_MERGES_WEIGHT * merges
+                                  - SCORE_MONOTONICITY_WEIGHT * std::min(monotonicity_left, monotonicity_right)
+                                  - SCORE_SUM_WEIGHT * sum;
 
         // execute a move to the left
         int i;
@@ -141,9 +202,100 @@ void InitLookUpTables() {
         row_t rev_result = reverse_row(result);
         unsigned rev_row = reverse_row(row);
 
-        row_left_table [    row] =                row  ^                result;
-        row_right_table[rev_row] =            rev_row  ^            rev_result;
-        col_up_table   [    row] = unpack_col(    row) ^ unpack_col(    result);
-        col_down_table [rev_row] = unpack_col(rev_row) ^ unpack_col(rev_result);
+        t.row_left_table [    row] =                row  ^                result;
+        t.row_right_table[rev_row] =            rev_row  ^            rev_result;
+        t.col_up_table   [    row] = unpack_col(    row) ^ unpack_col(    result);
+        t.col_down_table [rev_row] = unpack_col(rev_row) ^ unpack_col(rev_result);
+    }
+
+    // the score tables are complete only now, so the fused entries are filled in a second pass
+    for (unsigned row = 0; row < 65536; ++row) {
+        row_t left = t.row_left_table[row];
+        row_t right = t.row_right_table[row];
+        reward_t left_reward = t.score_table[row ^ left] - t.score_table[row];
+        reward_t right_reward = t.score_table[row ^ right] - t.score_table[row];
+
+        t.line_left_move_table[row] = {t.col_up_table[row], left_reward, left};
+        t.line_right_move_table[row] = {t.col_down_table[row], right_reward, right};
+
+        // bit 3 (left) and bit 1 (right) line up with the slide directions of a row
+        t.row_can_move_table[row] = (left ? 0b1000 : 0) | (right ? 0b0010 : 0);
+
+        const reward_t *code = std::find(line_reward_values, line_reward_values + 14, left_reward);
+        if (code == line_reward_values + 14) {
+            std::fprintf(stderr, "no reward code for %g\n", double(left_reward));
+            std::abort();
+        }
+        t.line_meta_table[row] = uint32_t(left) | uint32_t(code - line_reward_values) << 16 |
+                                 uint32_t(t.row_max_table[row]) << 20 | uint32_t(t.row_can_move_table[row]) << 24;
     }
-}
\ No newline at end of file
+}
+
+#ifndef THREES_TABLE_GEN
+
+#ifdef THREES_COMPACT_TABLES
+#include "LookUpTableCompactData.h"
+#else
+#include "LookUpTableData.h"
+#endif
+
+/**
+ * regenerate every table at runtime and compare it byte-for-byte with the baked one
+ * return true if all tables match
+ */
+static bool VerifyLookUpTables() {
+    std::unique_ptr<LookUpTableSet> generated(new LookUpTableSet());
+    GenerateLookUpTables(*generated);
+
+    bool matched = true;
+#define THREES_VERIFY_TABLE(type, name) \
+    if (std::memcmp(generated->name, name, sizeof(name)) != 0) { \
+        std::printf("%-20s mismatch\n", #name); \
+        matched = false; \
+    } else { \
+        std::printf("%-20s ok (%zu bytes)\n", #name, sizeof(name)); \
+    }
+    THREES_LOOKUP_TABLES(THREES_VERIFY_TABLE)
+#undef THREES_VERIFY_TABLE
+
+    return matched;
+}
+
+/**
+ * the per-line queries the board needs, whichever set of tables is baked in
+ * bit 3 of LineCanMove is set when the line can slide toward the low nibble, bit 1 toward the high one
+ */
+#ifdef THREES_COMPACT_TABLES
+
+static unsigned LineCanMove(row_t line) {
+    return (line_meta_table[line] >> 24) & 0b1010;
+}
+
+static cell_t LineMaxTile(row_t line) {
+    return cell_t((line_meta_table[line] >> 20) & 0xF);
+}
+
+#else
+
+static unsigned LineCanMove(row_t line) {
+    return row_can_move_table[line];
+}
+
+static cell_t LineMaxTile(row_t line) {
+    return row_max_table[line];
+}
+
+#endif
+
+/**
+ * bytes of lookup tables baked into this build
+ */
+static size_t LookUpTableFootprint() {
+    size_t bytes = 0;
+#define THREES_TABLE_BYTES(type, name) bytes += sizeof(name);
+    THREES_LOOKUP_TABLES(THREES_TABLE_BYTES)
+#undef THREES_TABLE_BYTES
+    return bytes;
+}
+
+#endif
@@ -11,32 +11,99 @@
 #include <fstream>
 #include <memory>
 #include <array>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <immintrin.h>
+#include <sys/stat.h>
 #include "Board64.h"
+#include "Weights.h"
+#include "WeightTable.h"
+#include "SparseTable.h"
+
+/**
+ * the tuple indices are gathered with BMI2 pext where the host has it, checked once at runtime,
+ * otherwise the tuples fall back to GetIndex
+ */
+static bool HasBmi2() {
+    static const bool has_bmi2 = __builtin_cpu_supports("bmi2");
+    return has_bmi2;
+}
+
+/**
+ * what every feature of one evaluation reads: the board, the hint, and the 8 symmetric boards,
+ * which carry their column-major views, built once and shared by all the features
+ */
+struct TupleInput {
+    TupleInput(const Board64 &board, int hint) : board(board), hint(hint), symmetries(Symmetries(board)) {}
+
+    Board64 board;
+    int hint;
+    std::array<Board64, 8> symmetries;
+};
 
-
-class Tuple {
-public:
-    Tuple() = default;
-
-    virtual float GetValue(Board64 board, int hint) { return 0; }
-
-    virtual board_t GetIndex(Board64 board, int hint, int id) { return 0; }
-
-    virtual void UpdateValue(Board64 b, int hint, float delta) {}
-
-    virtual void save(std::ofstream &out) {}
-
-    virtual void load(std::ifstream &in) {}
+/**
+ * how the cells enter the indices of a feature whose indices are the tiles of fixed cells, probed with a lone
+ * tile 1 on each cell of an empty board: it changes exactly the indices of the patterns that contain the cell,
+ * by the place value of the cell in them
+ */
+template<typename Tuple>
+struct PatternCells {
+    std::array<uint32_t, 16> touching;                              // bit k: index k reads the cell
+    std::array<std::array<board_t, Tuple::index_count>, 16> unit;  // what a tile 1 on the cell adds to index k
+
+    explicit PatternCells(Tuple &tuple) : touching(), unit() {
+        board_t empty[Tuple::index_count], index[Tuple::index_count];
+        tuple.GetIndices(TupleInput(Board64(), 1), empty);
+
+        for (int cell = 0; cell < 16; ++cell) {
+            Board64 board;
+            board.Place(cell, 1);
+            tuple.GetIndices(TupleInput(board, 1), index);
+            for (int k = 0; k < Tuple::index_count; ++k) {
+                unit[cell][k] = index[k] - empty[k];
+                if (unit[cell][k]) touching[cell] |= 1u << k;
+            }
+        }
+    }
 };
 
-class AxeTuple : public Tuple {
+/**
+ * the features of a network are plain classes composed at compile time by TupleNetwork
+ * an evaluation is split in stages, each feature provides
+ *   static const int index_count                                 number of weights it reads per board
+ *   void GetIndices(const TupleInput &input, board_t *index)     fill index[0..index_count)
+ *   void Prefetch(const board_t *index) const                    start fetching the weights at those indices
+ *   float GetValue(const board_t *index)                         sum of its weights at those indices
+ *   void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index)
+ *                                                                the indices of child, the board of parent with a
+ *                                                                tile placed on the empty cell, from those of parent
+ *   uint32_t Touching(int cell)                                  bit k set if index k reads the cell
+ *   typedef ... Weights                                          the weights at its indices, one per index
+ *   void Fetch(const board_t *index, uint32_t mask, Weights &w)  read the weights of the indices in mask
+ *   float Sum(const board_t *index, const Weights &weights)      their value, exactly as GetValue
+ *   void UpdateValue(const board_t *index, float delta)
+ *   void save(std::ofstream &out)
+ *   void load(std::ifstream &in)
+ *   void map(WeightCursor &in)                                   load, pointing the large tables into a mapped file
+ *   void Place(const WeightPlacement &placement)                 move the large tables, before they are loaded
+ *   void Memory(WeightMemory &memory) const                      the memory its tables got
+ *   static size_t Bytes()                                        size of its block in a weight file
+ *   static std::string Layout()                                  "name:type:weights", names the block in a weight file
+ *   static void Convert(std::ifstream &in, std::ofstream &out)   float block of a weight file to this feature's
+ * and writes its weights in its own fixed-size block
+ *
+ * the two big pattern features store their tables as Weight (float, int16_t or Half, see Weights.h, or Sparse,
+ * see SparseTable.h),
+ * the others are always float; tables of a MB or more are WeightTables (see WeightTable.h)
+ */
+template<typename Weight = float>
+class AxeTuple {
 public:
-    AxeTuple() : Tuple() {
-        std::fill(lookup_table_[0].begin(), lookup_table_[0].end(), 0);
-        std::fill(lookup_table_[1].begin(), lookup_table_[1].end(), 0);
-    }
+    AxeTuple() : lookup_table_{WeightTable<Weight>(SIX_TUPLE_AND_HINT_SIZE),
+                             WeightTable<Weight>(SIX_TUPLE_AND_HINT_SIZE)} {}
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
+    board_t GetIndex(Board64 board, int hint, int id) {
         board_t c1 = board.GetCol(id);
         board_t c2 = board.GetCol(id + 1);
         board_t index = ((((c1 & 0xffff) << 8) | ((c2 & 0xff00) >> 8)) << 2) | (std::min(4, hint) - 1);
@@ -44,70 +111,148 @@ public:
         return index;
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        Board64 b = board;
+    static const int index_count = 16;
+
+    /**
+     * the indices of both patterns on the 8 symmetric boards, in the order they are summed:
+     * index[4 * i + 2 * j + k] is pattern j of symmetries[2 * i + k]
+     */
+    void GetIndices(const TupleInput &input, board_t *index) {
+        if (HasBmi2()) {
+            GetIndicesPext(input.symmetries, input.hint, index);
+            return;
+        }
 
         for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 2; j++) {
-                Board64 temp_board = b;
+            for (int j = 0; j < 2; ++j) {
+                index[4 * i + 2 * j] = GetIndex(input.symmetries[2 * i], input.hint, j);
+                index[4 * i + 2 * j + 1] = GetIndex(input.symmetries[2 * i + 1], input.hint, j);
+            }
+        }
+    }
+
+    /**
+     * pattern j is column j and the high byte of column j + 1, i.e. bits 16j..16j+31 of the column-major
+     * board under the mask below, so one pext gathers it and the two fields only have to swap places
+     */
+    __attribute__((target("bmi2")))
+    static void GetIndicesPext(const std::array<Board64, 8> &symmetries, int hint, board_t index[16]) {
+        static const board_t mask[2] = {0x00000000FF00FFFFULL, 0x0000FF00FFFF0000ULL};
+        board_t h = board_t(std::min(4, hint) - 1);
+
+        for (int s = 0; s < 8; ++s) {
+            board_t transpose_board = symmetries[s].GetTransposedBoard();
+            for (int j = 0; j < 2; ++j) {
+                board_t p = _pext_u64(transpose_board, mask[j]);
+                index[4 * (s / 2) + 2 * j + s % 2] = ((((p & 0xffff) << 8) | (p >> 16)) << 2) | h;
+            }
+        }
+    }
 
-                board_t index = GetIndex(temp_board, hint, j);
-                lookup_table_[j][index] += delta;
+    void UpdateValue(const board_t *index, float delta) {
+        for (int k = 0; k < 16; ++k) {
+            lookup_table_[(k >> 1) & 1].Update(index[k], delta);
+        }
+    }
 
-                temp_board.ReflectVertical();
+    void Prefetch(const board_t *index) const {
+        for (int k = 0; k < 16; ++k) {
+            lookup_table_[(k >> 1) & 1].Prefetch(index[k]);
+        }
+    }
 
-                index = GetIndex(temp_board, hint, j);
-                lookup_table_[j][index] += delta;
-            }
-            b.TurnRight();
+    float GetValue(const board_t *index) {
+        WeightSum<Weight> total_value;
+
+        for (int k = 0; k < 16; ++k) {
+            total_value.Add((k >> 1) & 1, lookup_table_[(k >> 1) & 1][index[k]]);
         }
+
+        return total_value.Value(scale_);
     }
 
-    float GetValue(Board64 board, int hint) override {
-        float total_value = 0.0;
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        const PatternCells<AxeTuple> &cells = Cells();
+        board_t tile = board_t(child(cell));
+        for (int k = 0; k < 16; ++k) {
+            index[k] = parent[k] + tile * cells.unit[cell][k];
+        }
+    }
 
-        Board64 b = board;
+    uint32_t Touching(int cell) { return Cells().touching[cell]; }
 
-        for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 2; ++j) {
-                Board64 temp_board = b;
+    typedef std::array<typename WeightTraits<Weight>::Value, 16> Weights;
 
-                board_t index = GetIndex(temp_board, hint, j);
-                total_value += lookup_table_[j][index];
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        for (; mask != 0; mask &= mask - 1) {
+            int k = __builtin_ctz(mask);
+            weights[k] = lookup_table_[(k >> 1) & 1][index[k]];
+        }
+    }
 
-                temp_board.ReflectVertical();
+    float Sum(const board_t *index, const Weights &weights) const {
+        WeightSum<Weight> total_value;
 
-                index = GetIndex(temp_board, hint, j);
-                total_value += lookup_table_[j][index];
-            }
-            b.TurnRight();
+        for (int k = 0; k < 16; ++k) {
+            total_value.Add((k >> 1) & 1, weights[k]);
         }
 
-        return total_value;
+        return total_value.Value(scale_);
+    }
+
+    void save(std::ofstream &out) {
+        SaveWeights(out, lookup_table_[0], scale_[0]);
+        SaveWeights(out, lookup_table_[1], scale_[1]);
     }
 
-    void save(std::ofstream &out) override {
-        out.write(reinterpret_cast<char *>(&lookup_table_[0][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
-        out.write(reinterpret_cast<char *>(&lookup_table_[1][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
+    void load(std::ifstream &in) {
+        LoadWeights(in, lookup_table_[0], scale_[0]);
+        LoadWeights(in, lookup_table_[1], scale_[1]);
     }
 
-    void load(std::ifstream &in) override {
-        in.read(reinterpret_cast<char *>(&lookup_table_[0][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
-        in.read(reinterpret_cast<char *>(&lookup_table_[1][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
+    void map(WeightCursor &in) {
+        MapWeights(in, lookup_table_[0], scale_[0]);
+        MapWeights(in, lookup_table_[1], scale_[1]);
+    }
+
+    void Place(const WeightPlacement &placement) {
+        lookup_table_[0].Place(placement);
+        lookup_table_[1].Place(placement);
+    }
+
+    void Memory(WeightMemory &memory) const {
+        lookup_table_[0].Memory(memory);
+        lookup_table_[1].Memory(memory);
+    }
+
+    static size_t Bytes() { return 2 * TableBytes<Weight>(SIX_TUPLE_AND_HINT_SIZE); }
+
+    static std::string Layout() {
+        return std::string("axe:") + WeightTraits<Weight>::Name() + ":2x" + std::to_string(SIX_TUPLE_AND_HINT_SIZE);
+    }
+
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        QuantizeWeights<Weight>(in, out, SIX_TUPLE_AND_HINT_SIZE);
+        QuantizeWeights<Weight>(in, out, SIX_TUPLE_AND_HINT_SIZE);
     }
 
 private:
-    std::array<std::array<float, SIX_TUPLE_AND_HINT_SIZE>, 2> lookup_table_;
+    const PatternCells<AxeTuple> &Cells() {
+        static const PatternCells<AxeTuple> cells(*this);
+        return cells;
+    }
+
+    WeightTable<Weight> lookup_table_[2];
+    float scale_[2] = {1.0f, 1.0f};
 };
 
-class RectangleTuple : public Tuple {
+template<typename Weight = float>
+class RectangleTuple {
 public:
-    RectangleTuple() {
-        std::fill(lookup_table_[0].begin(), lookup_table_[0].end(), 0);
-        std::fill(lookup_table_[1].begin(), lookup_table_[1].end(), 0);
-    }
+    RectangleTuple() : lookup_table_{WeightTable<Weight>(SIX_TUPLE_AND_HINT_SIZE),
+                             WeightTable<Weight>(SIX_TUPLE_AND_HINT_SIZE)} {}
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
+    board_t GetIndex(Board64 board, int hint, int id) {
         board_t c1 = board.GetCol(id);
         board_t c2 = board.GetCol(id + 1);
         board_t index = ((c1 & 0xfff) << 12ULL) | (c2 & 0xfff);
@@ -115,73 +260,167 @@ public:
         return (std::min(4, hint) - 1) | (index << 2);
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        Board64 b = board;
+    static const int index_count = 16;
+
+    /**
+     * same layout as AxeTuple::GetIndices
+     */
+    void GetIndices(const TupleInput &input, board_t *index) {
+        if (HasBmi2()) {
+            GetIndicesPext(input.symmetries, input.hint, index);
+            return;
+        }
 
         for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 2; j++) {
-                Board64 temp_board = b;
+            for (int j = 0; j < 2; ++j) {
+                index[4 * i + 2 * j] = GetIndex(input.symmetries[2 * i], input.hint, j);
+                index[4 * i + 2 * j + 1] = GetIndex(input.symmetries[2 * i + 1], input.hint, j);
+            }
+        }
+    }
 
-                board_t index1 = GetIndex(temp_board, hint, j);
-                lookup_table_[j][index1] += delta;
+    /**
+     * pattern j is the low 12 bits of columns j and j + 1
+     */
+    __attribute__((target("bmi2")))
+    static void GetIndicesPext(const std::array<Board64, 8> &symmetries, int hint, board_t index[16]) {
+        static const board_t mask[2] = {0x000000000FFF0FFFULL, 0x00000FFF0FFF0000ULL};
+        board_t h = board_t(std::min(4, hint) - 1);
 
-                temp_board.ReflectVertical();
+        for (int s = 0; s < 8; ++s) {
+            board_t transpose_board = symmetries[s].GetTransposedBoard();
+            for (int j = 0; j < 2; ++j) {
+                board_t p = _pext_u64(transpose_board, mask[j]);
+                index[4 * (s / 2) + 2 * j + s % 2] = h | ((((p & 0xfff) << 12) | (p >> 12)) << 2);
+            }
+        }
+    }
 
-                board_t index2 = GetIndex(temp_board, hint, j);
-                if (j == 1 && index1 != index2) {
-                    lookup_table_[j][index2] += delta;
-                }
+    /**
+     * pattern 0 is visited on the turned boards only, pattern 1 on the reflected ones too
+     * unless the reflection gives the same index
+     */
+    void UpdateValue(const board_t *index, float delta) {
+        for (int i = 0; i < 4; ++i) {
+            lookup_table_[0].Update(index[4 * i], delta);
+            lookup_table_[1].Update(index[4 * i + 2], delta);
+            if (index[4 * i + 2] != index[4 * i + 3]) {
+                lookup_table_[1].Update(index[4 * i + 3], delta);
             }
-            b.TurnRight();
         }
     }
 
-    float GetValue(Board64 board, int hint) override {
-        float total_value = 0.0;
+    void Prefetch(const board_t *index) const {
+        for (int i = 0; i < 4; ++i) {
+            lookup_table_[0].Prefetch(index[4 * i]);
+            lookup_table_[1].Prefetch(index[4 * i + 2]);
+            lookup_table_[1].Prefetch(index[4 * i + 3]);
+        }
+    }
 
-        Board64 b = board;
+    float GetValue(const board_t *index) {
+        WeightSum<Weight> total_value;
 
         for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 2; ++j) {
-                Board64 temp_board = b;
+            total_value.Add(0, lookup_table_[0][index[4 * i]]);
+            total_value.Add(1, lookup_table_[1][index[4 * i + 2]]);
+            if (index[4 * i + 2] != index[4 * i + 3]) {
+                total_value.Add(1, lookup_table_[1][index[4 * i + 3]]);
+            }
+        }
 
-                board_t index1 = GetIndex(temp_board, hint, j);
-                total_value += lookup_table_[j][index1];
+        return total_value.Value(scale_);
+    }
+
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        const PatternCells<RectangleTuple> &cells = Cells();
+        board_t tile = board_t(child(cell));
+        for (int k = 0; k < 16; ++k) {
+            index[k] = parent[k] + tile * cells.unit[cell][k];
+        }
+    }
+
+    uint32_t Touching(int cell) { return Cells().touching[cell]; }
+
+    typedef std::array<typename WeightTraits<Weight>::Value, 16> Weights;
+
+    // the indices GetValue reads, pattern 0 is not read on the reflected boards
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        for (mask &= 0xdddd; mask != 0; mask &= mask - 1) {
+            int k = __builtin_ctz(mask);
+            weights[k] = lookup_table_[(k >> 1) & 1][index[k]];
+        }
+    }
 
-                temp_board.ReflectVertical();
+    float Sum(const board_t *index, const Weights &weights) const {
+        WeightSum<Weight> total_value;
 
-                board_t index2 = GetIndex(temp_board, hint, j);
-                if (j == 1 && index1 != index2) {
-                    total_value += lookup_table_[j][index2];
-                }
+        for (int i = 0; i < 4; ++i) {
+            total_value.Add(0, weights[4 * i]);
+            total_value.Add(1, weights[4 * i + 2]);
+            if (index[4 * i + 2] != index[4 * i + 3]) {
+                total_value.Add(1, weights[4 * i + 3]);
             }
-            b.TurnRight();
         }
 
-        return total_value;
+        return total_value.Value(scale_);
+    }
+
+    void save(std::ofstream &out) {
+        SaveWeights(out, lookup_table_[0], scale_[0]);
+        SaveWeights(out, lookup_table_[1], scale_[1]);
+    }
+
+    void load(std::ifstream &in) {
+        LoadWeights(in, lookup_table_[0], scale_[0]);
+        LoadWeights(in, lookup_table_[1], scale_[1]);
+    }
+
+    void map(WeightCursor &in) {
+        MapWeights(in, lookup_table_[0], scale_[0]);
+        MapWeights(in, lookup_table_[1], scale_[1]);
+    }
+
+    void Place(const WeightPlacement &placement) {
+        lookup_table_[0].Place(placement);
+        lookup_table_[1].Place(placement);
+    }
+
+    void Memory(WeightMemory &memory) const {
+        lookup_table_[0].Memory(memory);
+        lookup_table_[1].Memory(memory);
     }
 
-    void save(std::ofstream &out) override {
-        out.write(reinterpret_cast<char *>(&lookup_table_[0][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
-        out.write(reinterpret_cast<char *>(&lookup_table_[1][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
+    static size_t Bytes() { return 2 * TableBytes<Weight>(SIX_TUPLE_AND_HINT_SIZE); }
+
+    static std::string Layout() {
+        return std::string("rectangle:") + WeightTraits<Weight>::Name() + ":2x" + std::to_string(SIX_TUPLE_AND_HINT_SIZE);
     }
 
-    void load(std::ifstream &in) override {
-        in.read(reinterpret_cast<char *>(&lookup_table_[0][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
-        in.read(reinterpret_cast<char *>(&lookup_table_[1][0]), (SIX_TUPLE_AND_HINT_SIZE) * sizeof(float));
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        QuantizeWeights<Weight>(in, out, SIX_TUPLE_AND_HINT_SIZE);
+        QuantizeWeights<Weight>(in, out, SIX_TUPLE_AND_HINT_SIZE);
     }
 
 private:
-    std::array<std::array<float, SIX_TUPLE_AND_HINT_SIZE>, 2> lookup_table_;
+    const PatternCells<RectangleTuple> &Cells() {
+        static const PatternCells<RectangleTuple> cells(*this);
+        return cells;
+    }
+
+    WeightTable<Weight> lookup_table_[2];
+    float scale_[2] = {1.0f, 1.0f};
 };
 
-class ValuableTileTuple : public Tuple {
+class ValuableTileTuple {
 public:
-    ValuableTileTuple() {
-        std::fill(lookup_table_.begin(), lookup_table_.end(), 0);
-    }
+    ValuableTileTuple() : lookup_table_(4194304) {}
+
+    board_t GetIndex(Board64 board, int hint, int id) {
+        if (HasBmi2()) {
+            return GetIndexPopcnt(board.GetBoard(), hint);
+        }
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
         Board64 b = board;
 
         int count_tile[15];
@@ -199,33 +438,93 @@ public:
         return (std::min(4, hint) - 1) | (index << 2);
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        lookup_table_[GetIndex(board, hint, 0)] += delta;
+    /**
+     * the cells holding tile v are the zero nibbles of board ^ (v in every nibble), so each count is a popcount
+     * (every BMI2 host has popcnt)
+     */
+    __attribute__((target("popcnt")))
+    static board_t GetIndexPopcnt(board_t board, int hint) {
+        board_t index = 0;
+        for (board_t v = 10; v < 15; v++) {
+            index = (index << 4) | board_t(__builtin_popcountll(ZeroNibbles(board ^ (v * 0x1111111111111111ULL))));
+        }
+
+        return (std::min(4, hint) - 1) | (index << 2);
+    }
+
+    static const int index_count = 1;
+
+    void GetIndices(const TupleInput &input, board_t *index) {
+        index[0] = GetIndex(input.board, input.hint, 0);
+    }
+
+    void UpdateValue(const board_t *index, float delta) {
+        lookup_table_[index[0]] += delta;
+    }
+
+    void Prefetch(const board_t *index) const {
+        lookup_table_.Prefetch(index[0]);
+    }
+
+    float GetValue(const board_t *index) {
+        return lookup_table_[index[0]];
+    }
+
+    // one more tile of its value, if it is counted
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        int tile = child(cell);
+        index[0] = parent[0] + (tile >= 10 && tile < 15 ? board_t(1) << (2 + 4 * (14 - tile)) : 0);
     }
 
-    float GetValue(Board64 board, int hint) override {
-        return lookup_table_[GetIndex(board, hint, 0)];
+    uint32_t Touching(int cell) { return 1; } // the index depends on the whole board
+
+    typedef std::array<float, 1> Weights;
+
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        if (mask & 1) weights[0] = lookup_table_[index[0]];
     }
 
-    void save(std::ofstream &out) override {
+    float Sum(const board_t *index, const Weights &weights) const { return weights[0]; }
+
+    void save(std::ofstream &out) {
         out.write(reinterpret_cast<char *>(&lookup_table_[0]), 4194304 * sizeof(float));
     }
 
-    void load(std::ifstream &in) override {
+    void load(std::ifstream &in) {
         in.read(reinterpret_cast<char *>(&lookup_table_[0]), 4194304 * sizeof(float));
     }
 
+    void map(WeightCursor &in) {
+        lookup_table_.Map(in);
+    }
+
+    void Place(const WeightPlacement &placement) {
+        lookup_table_.Place(placement);
+    }
+
+    void Memory(WeightMemory &memory) const {
+        lookup_table_.Memory(memory);
+    }
+
+    static size_t Bytes() { return 4194304 * sizeof(float); }
+
+    static std::string Layout() { return "valuable:float:4194304"; }
+
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        CopyWeights(in, out, 4194304);
+    }
+
 private:
-    std::array<float, 4194304> lookup_table_; // (hint-tile, 10-tile, 11-tile, 12-tile, 13-tile, 14-tile)
+    WeightTable<float> lookup_table_; // (hint-tile, 10-tile, 11-tile, 12-tile, 13-tile, 14-tile)
 };
 
-class EmptyTileTuple : public Tuple {
+class EmptyTileTuple {
 public:
     EmptyTileTuple() {
         std::fill(lookup_table_.begin(), lookup_table_.end(), 0);
     }
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
+    board_t GetIndex(Board64 board, int hint, int id) {
         board_t index = 0;
 
         for (int i = 0; i < 16; ++i) {
@@ -235,33 +534,72 @@ public:
         return (index << 2) | (std::min(4, hint) - 1);
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        lookup_table_[GetIndex(board, hint, 0)] += delta;
+    static const int index_count = 1;
+
+    void GetIndices(const TupleInput &input, board_t *index) {
+        index[0] = GetIndex(input.board, input.hint, 0);
+    }
+
+    void UpdateValue(const board_t *index, float delta) {
+        lookup_table_[index[0]] += delta;
     }
 
-    float GetValue(Board64 board, int hint) override {
-        return lookup_table_[GetIndex(board, hint, 0)];
+    void Prefetch(const board_t *index) const {} // 68 weights stay in cache
+
+    float GetValue(const board_t *index) {
+        return lookup_table_[index[0]];
+    }
+
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        index[0] = parent[0] - (1 << 2);
+    }
+
+    uint32_t Touching(int cell) { return 1; } // the index depends on the whole board
+
+    typedef std::array<float, 1> Weights;
+
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        if (mask & 1) weights[0] = lookup_table_[index[0]];
     }
 
-    void save(std::ofstream &out) override {
+    float Sum(const board_t *index, const Weights &weights) const { return weights[0]; }
+
+    void save(std::ofstream &out) {
         out.write(reinterpret_cast<char *>(&lookup_table_[0]), 68 * sizeof(float));
     }
 
-    void load(std::ifstream &in) override {
+    void load(std::ifstream &in) {
         in.read(reinterpret_cast<char *>(&lookup_table_[0]), 68 * sizeof(float));
     }
 
+    void map(WeightCursor &in) {
+        in.Read(&lookup_table_[0], 68 * sizeof(float));
+    }
+
+    void Place(const WeightPlacement &placement) {}
+
+    void Memory(WeightMemory &memory) const {
+        memory.backing["heap"] += sizeof(lookup_table_);
+        memory.resident += sizeof(lookup_table_);
+    }
+
+    static size_t Bytes() { return 68 * sizeof(float); }
+
+    static std::string Layout() { return "empty:float:68"; }
+
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        CopyWeights(in, out, 68);
+    }
+
 private:
     std::array<float, 68> lookup_table_;
 };
 
-class DistinctTilesTuple : public Tuple {
+class DistinctTilesTuple {
 public:
-    DistinctTilesTuple() {
-        std::fill(lookup_table_.begin(), lookup_table_.end(), 0);
-    }
+    DistinctTilesTuple() : lookup_table_(262144) {}
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
+    board_t GetIndex(Board64 board, int hint, int id) {
         board_t index = 0;
 
         for (int i = 0; i < 16; ++i) {
@@ -271,33 +609,79 @@ public:
         return (std::min(4, hint) - 1) | (index << 2);
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        lookup_table_[GetIndex(board, hint, 0)] += delta;
+    static const int index_count = 1;
+
+    void GetIndices(const TupleInput &input, board_t *index) {
+        index[0] = GetIndex(input.board, input.hint, 0);
+    }
+
+    void UpdateValue(const board_t *index, float delta) {
+        lookup_table_[index[0]] += delta;
     }
 
-    float GetValue(Board64 board, int hint) override {
-        return lookup_table_[GetIndex(board, hint, 0)];
+    void Prefetch(const board_t *index) const {
+        lookup_table_.Prefetch(index[0]);
+    }
+
+    float GetValue(const board_t *index) {
+        return lookup_table_[index[0]];
+    }
+
+    // the tile joins the set, and the empty cell leaves it if it was the last one
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        index[0] = parent[0] | (board_t(1) << (child(cell) + 2));
+        if (child.EmptyMask() == 0) index[0] &= ~board_t(1 << 2);
+    }
+
+    uint32_t Touching(int cell) { return 1; } // the index depends on the whole board
+
+    typedef std::array<float, 1> Weights;
+
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        if (mask & 1) weights[0] = lookup_table_[index[0]];
     }
 
-    void save(std::ofstream &out) override {
+    float Sum(const board_t *index, const Weights &weights) const { return weights[0]; }
+
+    void save(std::ofstream &out) {
         out.write(reinterpret_cast<char *>(&lookup_table_[0]), 262144 * sizeof(float));
     }
 
-    void load(std::ifstream &in) override {
+    void load(std::ifstream &in) {
         in.read(reinterpret_cast<char *>(&lookup_table_[0]), 262144 * sizeof(float));
     }
 
+    void map(WeightCursor &in) {
+        lookup_table_.Map(in);
+    }
+
+    void Place(const WeightPlacement &placement) {
+        lookup_table_.Place(placement);
+    }
+
+    void Memory(WeightMemory &memory) const {
+        lookup_table_.Memory(memory);
+    }
+
+    static size_t Bytes() { return 262144 * sizeof(float); }
+
+    static std::string Layout() { return "distinct:float:262144"; }
+
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        CopyWeights(in, out, 262144);
+    }
+
 private:
-    std::array<float, 262144> lookup_table_;
+    WeightTable<float> lookup_table_;
 };
 
-class MergeableTilesTuple : public Tuple {
+class MergeableTilesTuple {
 public:
     MergeableTilesTuple() {
         std::fill(lookup_table_.begin(), lookup_table_.end(), 0);
     }
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
+    board_t GetIndex(Board64 board, int hint, int id) {
         board_t index = 0;
 
         for (int i = 0; i < 16; ++i) {
@@ -314,33 +698,81 @@ public:
         return (index << 2) | (std::min(4, hint) - 1);
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        lookup_table_[GetIndex(board, hint, 0)] += delta;
+    static const int index_count = 1;
+
+    void GetIndices(const TupleInput &input, board_t *index) {
+        index[0] = GetIndex(input.board, input.hint, 0);
+    }
+
+    void UpdateValue(const board_t *index, float delta) {
+        lookup_table_[index[0]] += delta;
+    }
+
+    void Prefetch(const board_t *index) const {} // 68 weights stay in cache
+
+    float GetValue(const board_t *index) {
+        return lookup_table_[index[0]];
     }
 
-    float GetValue(Board64 board, int hint) override {
-        return lookup_table_[GetIndex(board, hint, 0)];
+    // the empty cell was in no pair, the tile pairs with every neighbour of its value
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        int tile = child(cell);
+        board_t pairs = 0;
+        if (cell % 4 != 3) pairs += child(cell + 1) == tile;
+        if (cell % 4 != 0) pairs += child(cell - 1) == tile;
+        if (cell < 12) pairs += child(cell + 4) == tile;
+        if (cell >= 4) pairs += child(cell - 4) == tile;
+        index[0] = parent[0] + (pairs << 2);
     }
 
-    void save(std::ofstream &out) override {
+    uint32_t Touching(int cell) { return 1; } // the index depends on the whole board
+
+    typedef std::array<float, 1> Weights;
+
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        if (mask & 1) weights[0] = lookup_table_[index[0]];
+    }
+
+    float Sum(const board_t *index, const Weights &weights) const { return weights[0]; }
+
+    void save(std::ofstream &out) {
         out.write(reinterpret_cast<char *>(&lookup_table_[0]), 68 * sizeof(float));
     }
 
-    void load(std::ifstream &in) override {
+    void load(std::ifstream &in) {
         in.read(reinterpret_cast<char *>(&lookup_table_[0]), 68 * sizeof(float));
     }
 
+    void map(WeightCursor &in) {
+        in.Read(&lookup_table_[0], 68 * sizeof(float));
+    }
+
+    void Place(const WeightPlacement &placement) {}
+
+    void Memory(WeightMemory &memory) const {
+        memory.backing["heap"] += sizeof(lookup_table_);
+        memory.resident += sizeof(lookup_table_);
+    }
+
+    static size_t Bytes() { return 68 * sizeof(float); }
+
+    static std::string Layout() { return "mergeable:float:68"; }
+
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        CopyWeights(in, out, 68);
+    }
+
 private:
     std::array<float, 68> lookup_table_;
 };
 
-class NeighboringVTile : public Tuple {
+class NeighboringVTile {
 public:
     NeighboringVTile() {
         std::fill(lookup_table_.begin(), lookup_table_.end(), 0);
     }
 
-    board_t GetIndex(Board64 board, int hint, int id) override {
+    board_t GetIndex(Board64 board, int hint, int id) {
         board_t index = 0;
 
         for (int i = 0; i < 16; ++i) {
@@ -357,70 +789,730 @@ public:
         return (index << 2) | (std::min(4, hint) - 1);
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) override {
-        lookup_table_[GetIndex(board, hint, 0)] += delta;
+    static const int index_count = 1;
+
+    void GetIndices(const TupleInput &input, board_t *index) {
+        index[0] = GetIndex(input.board, input.hint, 0);
     }
 
-    float GetValue(Board64 board, int hint) override {
-        return lookup_table_[GetIndex(board, hint, 0)];
+    void UpdateValue(const board_t *index, float delta) {
+        lookup_table_[index[0]] += delta;
     }
 
-    void save(std::ofstream &out) override {
+    void Prefetch(const board_t *index) const {} // 68 weights stay in cache
+
+    float GetValue(const board_t *index) {
+        return lookup_table_[index[0]];
+    }
+
+    // GetIndex counts the pairs (i, i + 1), once per condition that holds for i; an empty cell was in no pair
+    void PlaceIndices(const board_t *parent, const Board64 &child, int cell, board_t *index) {
+        int tile = child(cell);
+        board_t pairs = 0;
+        if (tile >= 10 && cell < 15 && (tile - 1 == child(cell + 1) || tile + 1 == child(cell + 1))) {
+            pairs += (cell % 4 != 3) + (cell < 12);
+        }
+        int left = cell - 1;
+        if (left >= 0 && child(left) >= 10 && (child(left) - 1 == tile || child(left) + 1 == tile)) {
+            pairs += (left % 4 != 3) + (left < 12);
+        }
+        index[0] = parent[0] + (pairs << 2);
+    }
+
+    uint32_t Touching(int cell) { return 1; } // the index depends on the whole board
+
+    typedef std::array<float, 1> Weights;
+
+    void Fetch(const board_t *index, uint32_t mask, Weights &weights) const {
+        if (mask & 1) weights[0] = lookup_table_[index[0]];
+    }
+
+    float Sum(const board_t *index, const Weights &weights) const { return weights[0]; }
+
+    void save(std::ofstream &out) {
         out.write(reinterpret_cast<char *>(&lookup_table_[0]), 68 * sizeof(float));
     }
 
-    void load(std::ifstream &in) override {
+    void load(std::ifstream &in) {
         in.read(reinterpret_cast<char *>(&lookup_table_[0]), 68 * sizeof(float));
     }
 
+    void map(WeightCursor &in) {
+        in.Read(&lookup_table_[0], 68 * sizeof(float));
+    }
+
+    void Place(const WeightPlacement &placement) {}
+
+    void Memory(WeightMemory &memory) const {
+        memory.backing["heap"] += sizeof(lookup_table_);
+        memory.resident += sizeof(lookup_table_);
+    }
+
+    static size_t Bytes() { return 68 * sizeof(float); }
+
+    static std::string Layout() { return "neighboring:float:68"; }
+
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        CopyWeights(in, out, 68);
+    }
+
 private:
     std::array<float, 68> lookup_table_;
 };
 
-class NTupleNetwork {
+template<size_t... I>
+struct IndexSequence {};
+
+template<size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template<size_t... I>
+struct MakeIndexSequence<0, I...> {
+    typedef IndexSequence<I...> type;
+};
+
+/**
+ * number of weights a network of the features Tuples... reads per evaluation
+ */
+template<typename... Tuples>
+struct TupleIndexCount;
 
+template<>
+struct TupleIndexCount<> {
+    static const int value = 0;
+};
+
+template<typename Tuple, typename... Rest>
+struct TupleIndexCount<Tuple, Rest...> {
+    static const int value = Tuple::index_count + TupleIndexCount<Rest...>::value;
+};
+
+/**
+ * a network of the features Tuples..., summed in that order
+ * the feature types are known at compile time, so every call is resolved statically and inlined into one
+ * evaluation, and save/load go through the features in the same order as the weight files
+ *
+ * GetValue(board, hint) runs three stages that are also available on their own:
+ * TupleInput (the shared symmetry pass), GetIndices (index calculation) and GetValue(index) (the weight fetches)
+ * Prefetch(index) issues every weight load of a board up front; the batched evaluations (LeafMax, GetValues,
+ * LeafMax3) prefetch all their boards before fetching any, so the cache misses of the batch overlap; a single
+ * board gains nothing from it, its loads are independent and already overlap
+ */
+template<typename... Tuples>
+class TupleNetwork {
 public:
-    NTupleNetwork() {
-        tuples.emplace_back(new AxeTuple());
-        tuples.emplace_back(new RectangleTuple());
-        tuples.emplace_back(new ValuableTileTuple());
-        tuples.emplace_back(new DistinctTilesTuple());
-        tuples.emplace_back(new MergeableTilesTuple());
-        tuples.emplace_back(new EmptyTileTuple());
-        tuples.emplace_back(new NeighboringVTile());
+    typedef std::array<board_t, TupleIndexCount<Tuples...>::value> Indices;
+
+    TupleNetwork() : tuples_(std::unique_ptr<Tuples>(new Tuples())...) {}
+
+    // a deep copy, every feature is copied into a new allocation
+    TupleNetwork(const TupleNetwork &network)
+            : TupleNetwork(network, typename MakeIndexSequence<sizeof...(Tuples)>::type()) {}
+
+    void GetIndices(const TupleInput &input, Indices &index) {
+        IndicesOf indices = {input, &index[0]};
+        ForEach(indices);
     }
 
-    float GetValue(Board64 board, int hint) {
-        float total_value = 0;
-        for (auto &tuple : tuples) {
-            total_value += tuple->GetValue(board, hint);
+    void Prefetch(const Indices &index) {
+        PrefetchOf prefetch = {&index[0]};
+        ForEach(prefetch);
+    }
+
+    float GetValue(const Indices &index) {
+        ValueOf value = {&index[0], 0};
+        ForEach(value);
+
+        return value.total_value;
+    }
+
+    // the weights one evaluation reads, feature by feature
+    typedef std::tuple<typename Tuples::Weights...> Weights;
+
+    /**
+     * the indices of child, the board with the indices parent and a tile placed on its empty cell
+     */
+    void PlaceIndices(const Indices &parent, const Board64 &child, int cell, Indices &index) {
+        PlaceIndicesOf place = {&parent[0], child, cell, &index[0]};
+        ForEach(place);
+    }
+
+    /**
+     * the values of children[0..count), board with a tile placed on its empty cell cells[i], all with hint
+     * the indices of board are computed once, a child only updates those its cell enters (see PlaceIndices);
+     * the first child reads all its weights, any other differs from it in two cells, its own and the first one's,
+     * and reads again only the weights of the patterns on those two (see Touching), the rest are copied
+     * the weights are summed as in GetValue, so the values are exactly its values; at most 16 children
+     */
+    void GetValues(Board64 board, int hint, const Board64 *children, const int *cells, int count, float *values) {
+        if (count == 1) { // nothing to share
+            values[0] = GetValue(children[0], hint);
+            return;
+        }
+
+        Indices parent;
+        std::array<Indices, 16> index;
+        GetIndices(TupleInput(board, hint), parent);
+        for (int i = 0; i < count; ++i) {
+            PlaceIndices(parent, children[i], cells[i], index[i]);
+            Prefetch(index[i]);
         }
 
+        Weights first, weights;
+        for (int i = 0; i < count; ++i) {
+            FetchOf fetch = {&index[i][0], i ? (1u << cells[0]) | (1u << cells[i]) : 0xffffu};
+            ForEach(fetch, i ? (weights = first) : first);
 
-        return total_value;
+            SumOf sum = {&index[i][0], 0};
+            ForEach(sum, i ? weights : first);
+            values[i] = sum.total_value;
+        }
     }
 
-    void UpdateValue(Board64 board, int hint, float delta) {
-        for (auto &tuple : tuples) {
-            tuple->UpdateValue(board, hint, delta);
+    /**
+     * the values of a board with each hint h of 1..3 whose bit 1 << h is in hint_mask, into values[h - 1],
+     * from index, the indices of the board with hint 1
+     * every feature keeps min(4, hint) - 1 in the low 2 bits of its indices, so the indices of the other hints are
+     * index + h - 1 and their weights share the cache lines of hint 1: after Prefetch(index) the lookups of the
+     * second and third hint are cache hits; each value is summed as in GetValue, so it is exactly GetValue(board, h)
+     */
+    void GetValues3(const Indices &index, unsigned hint_mask, float *values) {
+        Indices hinted;
+        for (int hint = 1; hint <= 3; ++hint) {
+            if ((hint_mask & (1u << hint)) == 0) continue;
+
+            for (size_t k = 0; k < index.size(); ++k) hinted[k] = index[k] + board_t(hint - 1);
+            values[hint - 1] = GetValue(hinted);
         }
     }
 
+    void GetValues3(Board64 board, unsigned hint_mask, float *values) {
+        Indices index;
+        GetIndices(TupleInput(board, 1), index);
+        Prefetch(index);
+        GetValues3(index, hint_mask, values);
+    }
+
+    void UpdateValue(const Indices &index, float delta) {
+        Update update = {&index[0], delta};
+        ForEach(update);
+    }
+
+    float GetValue(Board64 board, int hint) {
+        Indices index;
+        GetIndices(TupleInput(board, hint), index);
+        return GetValue(index);
+    }
+
+    void UpdateValue(Board64 board, int hint, float delta) {
+        Indices index;
+        GetIndices(TupleInput(board, hint), index);
+        UpdateValue(index, delta);
+    }
+
     void save(std::ofstream &save_stream) {
-        for (auto &tuple : tuples) {
-            tuple->save(save_stream);
+        Save save = {save_stream};
+        ForEach(save);
+    }
+
+    void load(std::ifstream &load_stream) {
+        Load load = {load_stream};
+        ForEach(load);
+    }
+
+    void map(WeightCursor &cursor) {
+        Map map = {cursor};
+        ForEach(map);
+    }
+
+    void Place(const WeightPlacement &placement) {
+        PlaceTables place = {placement};
+        ForEach(place);
+    }
+
+    /**
+     * the memory of every feature, named as in its Layout()
+     */
+    std::vector<std::pair<std::string, WeightMemory>> Memory() {
+        MemoryOf memory;
+        ForEach(memory);
+
+        return memory.features;
+    }
+
+private:
+    // the weights of a single feature run up to 512 MB, so each one lives on the heap
+    std::tuple<std::unique_ptr<Tuples>...> tuples_;
+
+    template<size_t... I>
+    TupleNetwork(const TupleNetwork &network, IndexSequence<I...>)
+            : tuples_(std::unique_ptr<Tuples>(new Tuples(*std::get<I>(network.tuples_)))...) {}
+
+    template<size_t I = 0, typename Visitor>
+    typename std::enable_if<I == sizeof...(Tuples)>::type ForEach(Visitor &visitor) {}
+
+    template<size_t I = 0, typename Visitor>
+    typename std::enable_if<I < sizeof...(Tuples)>::type ForEach(Visitor &visitor) {
+        visitor(*std::get<I>(tuples_));
+        ForEach<I + 1>(visitor);
+    }
+
+    // the same, along with the weights of each feature in an Evaluation
+
+    template<size_t I = 0, typename Visitor, typename Weights>
+    typename std::enable_if<I == sizeof...(Tuples)>::type ForEach(Visitor &visitor, Weights &weights) {}
+
+    template<size_t I = 0, typename Visitor, typename Weights>
+    typename std::enable_if<I < sizeof...(Tuples)>::type ForEach(Visitor &visitor, Weights &weights) {
+        visitor(*std::get<I>(tuples_), std::get<I>(weights));
+        ForEach<I + 1>(visitor, weights);
+    }
+
+    // the visitors walk the indices of the features one block after the other
+
+    struct IndicesOf {
+        const TupleInput &input;
+        board_t *index;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) {
+            tuple.GetIndices(input, index);
+            index += Tuple::index_count;
+        }
+    };
+
+    struct PrefetchOf {
+        const board_t *index;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) {
+            tuple.Prefetch(index);
+            index += Tuple::index_count;
+        }
+    };
+
+    struct ValueOf {
+        const board_t *index;
+        float total_value;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) {
+            total_value += tuple.GetValue(index);
+            index += Tuple::index_count;
+        }
+    };
+
+    struct PlaceIndicesOf {
+        const board_t *parent;
+        const Board64 &child;
+        int cell;
+        board_t *index;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) {
+            tuple.PlaceIndices(parent, child, cell, index);
+            parent += Tuple::index_count;
+            index += Tuple::index_count;
+        }
+    };
+
+    // the weights of the indices that read any of the cells in the mask
+    struct FetchOf {
+        const board_t *index;
+        unsigned cells;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple, typename Tuple::Weights &weights) {
+            uint32_t mask = 0;
+            for (unsigned c = cells; c != 0; c &= c - 1) mask |= tuple.Touching(__builtin_ctz(c));
+            tuple.Fetch(index, mask, weights);
+            index += Tuple::index_count;
+        }
+    };
+
+    struct SumOf {
+        const board_t *index;
+        float total_value;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple, const typename Tuple::Weights &weights) {
+            total_value += tuple.Sum(index, weights);
+            index += Tuple::index_count;
+        }
+    };
+
+    struct Update {
+        const board_t *index;
+        float delta;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) {
+            tuple.UpdateValue(index, delta);
+            index += Tuple::index_count;
+        }
+    };
+
+    struct Save {
+        std::ofstream &out;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) { tuple.save(out); }
+    };
+
+    struct Load {
+        std::ifstream &in;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) { tuple.load(in); }
+    };
+
+    struct Map {
+        WeightCursor &cursor;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) { tuple.map(cursor); }
+    };
+
+    struct PlaceTables {
+        const WeightPlacement &placement;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) { tuple.Place(placement); }
+    };
+
+    struct MemoryOf {
+        std::vector<std::pair<std::string, WeightMemory>> features;
+
+        template<typename Tuple>
+        void operator()(Tuple &tuple) {
+            std::string layout = Tuple::Layout();
+            features.emplace_back(layout.substr(0, layout.find(':')), WeightMemory());
+            tuple.Memory(features.back().second);
         }
+    };
+
+    template<size_t I = 0>
+    static typename std::enable_if<I == sizeof...(Tuples)>::type ConvertEach(std::ifstream &in, std::ofstream &out) {}
+
+    template<size_t I = 0>
+    static typename std::enable_if<I < sizeof...(Tuples)>::type ConvertEach(std::ifstream &in, std::ofstream &out) {
+        std::tuple_element<I, std::tuple<Tuples...>>::type::Convert(in, out);
+        ConvertEach<I + 1>(in, out);
+    }
+
+    template<size_t I = 0>
+    static typename std::enable_if<I == sizeof...(Tuples)>::type LayoutOf(std::string &layout, size_t &bytes) {}
+
+    template<size_t I = 0>
+    static typename std::enable_if<I < sizeof...(Tuples)>::type LayoutOf(std::string &layout, size_t &bytes) {
+        typedef typename std::tuple_element<I, std::tuple<Tuples...>>::type Tuple;
+        layout += (I ? " " : "") + Tuple::Layout();
+        bytes += Tuple::Bytes();
+        LayoutOf<I + 1>(layout, bytes);
+    }
+
+public:
+    /**
+     * the layouts of the features in file order, stored in a weight file header to check it fits the network
+     */
+    static std::string Layout() {
+        std::string layout;
+        size_t bytes = 0;
+        LayoutOf(layout, bytes);
+        return layout;
+    }
+
+    /**
+     * size of one stage of this network in a weight file
+     */
+    static size_t Bytes() {
+        std::string layout;
+        size_t bytes = 0;
+        LayoutOf(layout, bytes);
+        return bytes;
+    }
+
+public:
+    /**
+     * read a float weight file and write it in the storage of this network, one feature after the other
+     */
+    static void Convert(std::ifstream &in, std::ofstream &out) {
+        ConvertEach(in, out);
+    }
+};
+
+template<typename Weight>
+using TupleNetworkOf = TupleNetwork<AxeTuple<Weight>, RectangleTuple<Weight>, ValuableTileTuple, DistinctTilesTuple,
+                                    MergeableTilesTuple, EmptyTileTuple, NeighboringVTile>;
+
+typedef TupleNetworkOf<float> NTupleNetwork;
+typedef TupleNetworkOf<int16_t> Int16TupleNetwork;
+typedef TupleNetworkOf<Half> Fp16TupleNetwork;
+typedef TupleNetworkOf<Sparse> SparseTupleNetwork;
+
+static_assert(std::is_same<NTupleNetwork::Indices, Int16TupleNetwork::Indices>::value
+              && std::is_same<NTupleNetwork::Indices, Fp16TupleNetwork::Indices>::value
+              && std::is_same<NTupleNetwork::Indices, SparseTupleNetwork::Indices>::value,
+              "the weight types must share their indices");
+
+/**
+ * one stage of weights, in the storage named by `type`:
+ * "float" (the default, the only one that can learn), or "int16"/"fp16"/"sparse" files written by --quantize
+ */
+class ValueNetwork {
+public:
+    // every type has the same features, so the indices of a board do not depend on the type
+    typedef NTupleNetwork::Indices Indices;
+
+    explicit ValueNetwork(const std::string &type = "float") : type_(type) {
+        if (type == "int16") {
+            int16_.reset(new Int16TupleNetwork());
+        } else if (type == "fp16") {
+            fp16_.reset(new Fp16TupleNetwork());
+        } else if (type == "sparse") {
+            sparse_.reset(new SparseTupleNetwork());
+        } else if (type == "float") {
+            float_.reset(new NTupleNetwork());
+        } else {
+            std::cerr << "unknown weight type: " << type << std::endl;
+            std::exit(-1);
+        }
+    }
+
+    // a copy owns all its weights, even if the original is mapped
+    ValueNetwork(const ValueNetwork &network) : type_(network.type_), placement_(network.placement_) {
+        if (network.float_) float_.reset(new NTupleNetwork(*network.float_));
+        if (network.int16_) int16_.reset(new Int16TupleNetwork(*network.int16_));
+        if (network.fp16_) fp16_.reset(new Fp16TupleNetwork(*network.fp16_));
+        if (network.sparse_) sparse_.reset(new SparseTupleNetwork(*network.sparse_));
+    }
+
+    const std::string &Type() const { return type_; }
+
+    /**
+     * see TupleNetwork::Layout and TupleNetwork::Bytes, for a network of the given type
+     * the size of a sparse network depends on its weights, Bytes is 0 for it
+     */
+    static std::string Layout(const std::string &type) {
+        if (type == "int16") return Int16TupleNetwork::Layout();
+        if (type == "fp16") return Fp16TupleNetwork::Layout();
+        if (type == "sparse") return SparseTupleNetwork::Layout();
+        return NTupleNetwork::Layout();
+    }
+
+    static size_t Bytes(const std::string &type) {
+        if (type == "int16") return Int16TupleNetwork::Bytes();
+        if (type == "fp16") return Fp16TupleNetwork::Bytes();
+        if (type == "sparse") return 0;
+        return NTupleNetwork::Bytes();
+    }
+
+    float GetValue(Board64 board, int hint) {
+        if (float_) return float_->GetValue(board, hint);
+        if (int16_) return int16_->GetValue(board, hint);
+        if (sparse_) return sparse_->GetValue(board, hint);
+        return fp16_->GetValue(board, hint);
+    }
+
+    /**
+     * see TupleNetwork::GetValues
+     */
+    void GetValues(Board64 board, int hint, const Board64 *children, const int *cells, int count, float *values) {
+        if (float_) return float_->GetValues(board, hint, children, cells, count, values);
+        if (int16_) return int16_->GetValues(board, hint, children, cells, count, values);
+        if (sparse_) return sparse_->GetValues(board, hint, children, cells, count, values);
+        return fp16_->GetValues(board, hint, children, cells, count, values);
+    }
+
+    /**
+     * see TupleNetwork::GetValues3
+     */
+    void GetValues3(Board64 board, unsigned hint_mask, float *values) {
+        if (float_) return float_->GetValues3(board, hint_mask, values);
+        if (int16_) return int16_->GetValues3(board, hint_mask, values);
+        if (sparse_) return sparse_->GetValues3(board, hint_mask, values);
+        return fp16_->GetValues3(board, hint_mask, values);
+    }
+
+    void GetValues3(const Indices &index, unsigned hint_mask, float *values) {
+        if (float_) return float_->GetValues3(index, hint_mask, values);
+        if (int16_) return int16_->GetValues3(index, hint_mask, values);
+        if (sparse_) return sparse_->GetValues3(index, hint_mask, values);
+        return fp16_->GetValues3(index, hint_mask, values);
+    }
+
+    /**
+     * the stages of GetValue, see TupleNetwork
+     */
+    void GetIndices(const TupleInput &input, Indices &index) {
+        if (float_) return float_->GetIndices(input, index);
+        if (int16_) return int16_->GetIndices(input, index);
+        if (sparse_) return sparse_->GetIndices(input, index);
+        return fp16_->GetIndices(input, index);
+    }
+
+    void Prefetch(const Indices &index) {
+        if (float_) return float_->Prefetch(index);
+        if (int16_) return int16_->Prefetch(index);
+        if (sparse_) return sparse_->Prefetch(index);
+        return fp16_->Prefetch(index);
+    }
+
+    float GetValue(const Indices &index) {
+        if (float_) return float_->GetValue(index);
+        if (int16_) return int16_->GetValue(index);
+        if (sparse_) return sparse_->GetValue(index);
+        return fp16_->GetValue(index);
+    }
+
+    void UpdateValue(Board64 board, int hint, float delta) {
+        if (float_) return float_->UpdateValue(board, hint, delta);
+        if (int16_) return int16_->UpdateValue(board, hint, delta);
+        if (sparse_) return sparse_->UpdateValue(board, hint, delta);
+        return fp16_->UpdateValue(board, hint, delta);
+    }
+
+    void save(std::ofstream &save_stream) {
+        if (float_) return float_->save(save_stream);
+        if (int16_) return int16_->save(save_stream);
+        if (sparse_) return sparse_->save(save_stream);
+        return fp16_->save(save_stream);
     }
 
     void load(std::ifstream &load_stream) {
-        for (auto &tuple : tuples) {
-            tuple->load(load_stream);
+        if (float_) return float_->load(load_stream);
+        if (int16_) return int16_->load(load_stream);
+        if (sparse_) return sparse_->load(load_stream);
+        return fp16_->load(load_stream);
+    }
+
+    /**
+     * point the network into a weight file instead of reading it, the pages are read as the search touches them
+     * read-only maps are shared with every process mapping the same file and must not be updated,
+     * writable ones are private copy-on-write maps
+     * a placed network (see Place) copies the weights into its own memory instead
+     * the stage starts at offset; false if the file cannot be mapped or is shorter than the network
+     */
+    bool map(const std::string &file_name, bool writable, size_t offset = 0) {
+        std::shared_ptr<MappedWeightFile> file = MappedWeightFile::Open(file_name, writable);
+        if (!file) return false;
+
+        WeightCursor cursor(file);
+        cursor.offset = offset;
+        cursor.copy = !placement_.Default();
+        if (float_) float_->map(cursor);
+        if (int16_) int16_->map(cursor);
+        if (fp16_) fp16_->map(cursor);
+        if (sparse_) sparse_->map(cursor);
+
+        if (!cursor.copy) {
+            file_name_ = file_name;
+            offset_ = offset;
+            read_only_ = !writable;
+        }
+        return bool(cursor);
+    }
+
+    /**
+     * see WeightPlacement, on a new network before it is loaded
+     */
+    void Place(const WeightPlacement &placement) {
+        placement_ = placement;
+        if (float_) float_->Place(placement);
+        if (int16_) int16_->Place(placement);
+        if (fp16_) fp16_->Place(placement);
+        if (sparse_) sparse_->Place(placement);
+    }
+
+    std::vector<std::pair<std::string, WeightMemory>> Memory() {
+        if (float_) return float_->Memory();
+        if (int16_) return int16_->Memory();
+        if (sparse_) return sparse_->Memory();
+        return fp16_->Memory();
+    }
+
+    /**
+     * the backings of all the tables together
+     */
+    WeightBacking Backing() {
+        WeightBacking backing;
+        for (auto &feature : Memory()) {
+            for (auto &entry : feature.second.backing) backing[entry.first] += entry.second;
+        }
+        return backing;
+    }
+
+    bool ReadOnly() const { return read_only_; }
+
+    /**
+     * a network that can be updated without touching this one:
+     * a private map of the same file if this one is mapped, otherwise a copy
+     */
+    std::shared_ptr<ValueNetwork> WritableCopy() const {
+        if (!file_name_.empty()) {
+            std::shared_ptr<ValueNetwork> network = std::make_shared<ValueNetwork>(type_);
+            if (network->map(file_name_, true, offset_)) return network;
         }
+        return std::make_shared<ValueNetwork>(*this);
     }
 
 private:
-    std::vector<std::unique_ptr<Tuple>> tuples;
+    std::string type_;
+    std::string file_name_; // the file the weights are mapped from, if they are
+    size_t offset_ = 0;
+    bool read_only_ = false;
+    WeightPlacement placement_;
+    std::unique_ptr<NTupleNetwork> float_;
+    std::unique_ptr<Int16TupleNetwork> int16_;
+    std::unique_ptr<Fp16TupleNetwork> fp16_;
+    std::unique_ptr<SparseTupleNetwork> sparse_;
 };
 
+/**
+ * convert a single stage float weight file to int16, fp16 or sparse
+ * usage: ./threes --quantize="in=weight0.bin out=weight-int16-0.bin type=int16"
+ */
+static int QuantizeWeightFile(const std::string &in_name, const std::string &out_name, const std::string &type) {
+    if (type != "int16" && type != "fp16" && type != "sparse") {
+        std::cerr << "unknown weight type: " << type << std::endl;
+        return 1;
+    }
+    std::ifstream in(in_name, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "cannot open " << in_name << std::endl;
+        return 1;
+    }
+    struct stat in_st, out_st;
+    if (stat(in_name.c_str(), &in_st) == 0 && stat(out_name.c_str(), &out_st) == 0 &&
+        in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+        std::cerr << out_name << " is the same file as " << in_name << std::endl;
+        return 1;
+    }
+
+    // written next to the file and renamed over it, a failed conversion leaves out as it was
+    std::string temp_name = out_name + ".tmp";
+    std::ofstream out(temp_name, std::ios::out | std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "cannot open " << temp_name << std::endl;
+        return 1;
+    }
+
+    if (type == "int16") {
+        Int16TupleNetwork::Convert(in, out);
+    } else if (type == "fp16") {
+        Fp16TupleNetwork::Convert(in, out);
+    } else {
+        SparseTupleNetwork::Convert(in, out);
+    }
+    out.close();
+
+    if (!in || !out || std::rename(temp_name.c_str(), out_name.c_str()) != 0) {
+        std::cerr << "failed to convert " << in_name << std::endl;
+        std::remove(temp_name.c_str());
+        return 1;
+    }
+    return 0;
+}
+
 
 #endif //THREES_PUZZLE_AI_NTUPLENETWORK_H
@@ -0,0 +1,92 @@
+//
+// The NUMA nodes of the host, and the node a thread runs on
+//
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+/**
+ * the numbers in a sysfs list such as "0", "0-1" or "0,2-3"
+ */
+static std::vector<int> ReadSysfsList(const std::string &file_name) {
+    std::vector<int> numbers;
+    std::ifstream list(file_name);
+    std::string range;
+    while (std::getline(list, range, ',')) {
+        int first = 0, last = 0;
+        int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields < 1) continue;
+        if (fields == 1) last = first;
+        for (int number = first; number <= last; number++) numbers.push_back(number);
+    }
+    return numbers;
+}
+
+/**
+ * the online NUMA nodes, from /sys/devices/system/node/online; node 0 where there is no such file
+ */
+static const std::vector<int> &NumaNodes() {
+    static const std::vector<int> nodes = [] {
+        std::vector<int> online = ReadSysfsList("/sys/devices/system/node/online");
+        return online.empty() ? std::vector<int>(1, 0) : online;
+    }();
+    return nodes;
+}
+
+/**
+ * the online NUMA nodes as a bit mask, for mbind
+ */
+static unsigned long NumaNodeMask() {
+    unsigned long mask = 0;
+    for (int node : NumaNodes()) {
+        if (node < 64) mask |= 1UL << node;
+    }
+    return mask ? mask : 1UL;
+}
+
+static std::vector<int> NumaNodeCpus(int node) {
+    return ReadSysfsList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+}
+
+/**
+ * the place in NumaNodes() of the node this thread runs on: the node it was pinned to (see PinToNumaNode),
+ * else the node of the CPU it ran on when first asked
+ */
+static int &ThreadNumaIndex() {
+    static thread_local int index = -1;
+    return index;
+}
+
+static int CurrentNumaIndex() {
+    int &index = ThreadNumaIndex();
+    if (index >= 0) return index;
+
+    index = 0;
+    int cpu = sched_getcpu();
+    for (size_t i = 0; i < NumaNodes().size(); i++) {
+        for (int node_cpu : NumaNodeCpus(NumaNodes()[i])) {
+            if (node_cpu == cpu) index = int(i);
+        }
+    }
+    return index;
+}
+
+/**
+ * run this thread on the CPUs of the index-th node only; false, and the thread stays where it was,
+ * if the node has no CPUs or they cannot be set
+ */
+static bool PinToNumaNode(int index) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : NumaNodeCpus(NumaNodes()[index])) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpus);
+    }
+    if (CPU_COUNT(&cpus) == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) != 0) return false;
+
+    ThreadNumaIndex() = index;
+    return true;
+}
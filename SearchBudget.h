@@ -0,0 +1,97 @@
+//
+// The time an agent may spend on a move, and the latency and depth it got
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * the clock of an iterative deepening search: Start at the beginning of a move sets the deadline, Tick is called
+ * by every node and reads the clock every 256 calls of a thread, once past the deadline it stays expired until the
+ * next Start, for the nodes of every thread
+ * without a budget (budget_ms=0) nothing expires, Start and Finish still record the latency and depth of each move
+ */
+class SearchBudget {
+public:
+    explicit SearchBudget(double budget_ms = 0) : budget_ms_(budget_ms) {}
+
+    bool Enabled() const { return budget_ms_ > 0; }
+
+    double budget_ms() const { return budget_ms_; }
+
+    void Start() {
+        start_ = Now();
+        expired_.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * whether the move ran out of time, for the nodes of the search
+     */
+    bool Tick() {
+        static thread_local unsigned ticks = 0;
+        if (!Enabled() || Expired() || (++ticks & 255) != 0) return Expired();
+        if (Elapsed() >= budget_ms_) expired_.store(true, std::memory_order_relaxed);
+        return Expired();
+    }
+
+    bool Expired() const { return expired_.load(std::memory_order_relaxed); }
+
+    // milliseconds since Start
+    double Elapsed() const { return std::chrono::duration<double, std::milli>(Now() - start_).count(); }
+
+    /**
+     * the move is made, depth is the deepest search it completed
+     */
+    void Finish(int depth) {
+        latencies_.push_back(Elapsed());
+        depths_[depth]++;
+    }
+
+    /**
+     * the latency percentiles and the depths reached over the moves since Reset
+     */
+    std::string Report() const {
+        std::stringstream report;
+        report << latencies_.size() << " moves";
+        if (latencies_.empty()) return report.str();
+
+        std::vector<double> sorted = latencies_;
+        std::sort(sorted.begin(), sorted.end());
+        report << std::fixed << std::setprecision(1) << ", latency p50 " << Percentile(sorted, 50) << " p90 "
+               << Percentile(sorted, 90) << " p99 " << Percentile(sorted, 99) << " max " << sorted.back() << " ms";
+        if (Enabled()) report << " (budget " << budget_ms_ << " ms)";
+        report << ", depth";
+        for (auto &depth : depths_) report << " " << depth.first << ":" << depth.second;
+
+        return report.str();
+    }
+
+    void Reset() {
+        latencies_.clear();
+        depths_.clear();
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static Clock::time_point Now() { return Clock::now(); }
+
+    // nearest rank
+    static double Percentile(const std::vector<double> &sorted, int p) {
+        size_t rank = (sorted.size() * p + 99) / 100;
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+
+    double budget_ms_;
+    Clock::time_point start_;
+    std::atomic<bool> expired_{false};
+    std::vector<double> latencies_;
+    std::map<int, size_t> depths_;
+};
@@ -0,0 +1,191 @@
+//
+// Sparse storage for the pattern tables: only the blocks a trained network ever wrote are kept
+//
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "Weights.h"
+#include "WeightTable.h"
+
+/**
+ * the weight type of a sparse table, served from files converted by --quantize="... type=sparse"
+ * a trained table is mostly zero, the entries TD learning never reached, so the table is cut in blocks of
+ * 16 weights (4 patterns with their 4 hints, one cache line) and only the blocks with a non-zero weight are kept
+ * lookups return the same floats as the dense table, so evaluations are exact; the tables are for inference only
+ */
+struct Sparse {};
+
+template<>
+struct WeightTraits<Sparse> {
+    typedef float Value;
+
+    static const bool quantized = false;
+
+    static const char *Name() { return "sparse"; }
+};
+
+template<>
+struct WeightSum<Sparse> {
+    float total_value = 0;
+
+    void Add(int table, float w) { total_value += w; }
+
+    float Value(const float *scale) const { return total_value; }
+};
+
+/**
+ * 32 blocks: which of them are kept, and the rank of the first kept one among all kept blocks
+ */
+struct SparseGroup {
+    uint32_t mask;
+    uint32_t base;
+};
+
+/**
+ * the directory has one group per 512 weights (1 MB for a 2^26 table) and the kept blocks follow in index order,
+ * so weight i is values[(base + popcount of the kept blocks before it in its group) * 16 + i % 16]
+ * in a file: uint32 n, uint32 kept blocks, uint32 padding bytes, the directory, the padding, the blocks;
+ * the padding puts the blocks on a 64 byte boundary of the file, so a mapped block is one cache line
+ */
+template<>
+class WeightTable<Sparse> {
+public:
+    static const size_t block_size = 16;
+    static const size_t group_size = 32 * block_size;
+
+    explicit WeightTable(size_t n) : size_(n), directory_((n + group_size - 1) / group_size), values_(0) {}
+
+    size_t size() const { return size_; }
+
+    float operator[](size_t i) const {
+        const SparseGroup &group = directory_[i / group_size];
+        uint32_t bit = uint32_t(i / block_size) % 32;
+        if (!((group.mask >> bit) & 1)) return 0.0f;
+
+        uint32_t rank = group.base + uint32_t(__builtin_popcount(group.mask & ((1u << bit) - 1)));
+        return values_[size_t(rank) * block_size + i % block_size];
+    }
+
+    /**
+     * only the directory entry: where the block lives is not known before it arrives
+     */
+    void Prefetch(size_t i) const { directory_.Prefetch(i / group_size); }
+
+    void Update(size_t i, float delta) {
+        std::cerr << "sparse weights are inference-only and cannot be updated" << std::endl;
+        std::exit(-1);
+    }
+
+    /**
+     * keep the blocks of a dense table that hold a non-zero weight
+     */
+    void Build(const float *weights) {
+        std::vector<float> kept;
+        uint32_t blocks = 0;
+        for (size_t g = 0; g < directory_.size(); g++) {
+            SparseGroup group = {0, blocks};
+            for (uint32_t bit = 0; bit < 32; bit++) {
+                size_t first = g * group_size + bit * block_size;
+                bool keep = false;
+                for (size_t i = first; i < first + block_size && i < size_; i++) keep |= weights[i] != 0.0f;
+                if (!keep) continue;
+
+                group.mask |= 1u << bit;
+                blocks++;
+                for (size_t i = first; i < first + block_size; i++) kept.push_back(i < size_ ? weights[i] : 0.0f);
+            }
+            directory_[g] = group;
+        }
+
+        values_.Reset(kept.size());
+        if (!kept.empty()) std::memcpy(values_.data(), kept.data(), kept.size() * sizeof(float));
+    }
+
+    void Save(std::ofstream &out) {
+        uint32_t header[3] = {uint32_t(size_), uint32_t(values_.size() / block_size), 0};
+        size_t blocks_at = size_t(out.tellp()) + sizeof(header) + directory_.size() * sizeof(SparseGroup);
+        header[2] = uint32_t((64 - blocks_at % 64) % 64);
+
+        std::vector<char> padding(header[2], 0);
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(directory_.data()), directory_.size() * sizeof(SparseGroup));
+        out.write(padding.data(), padding.size());
+        out.write(reinterpret_cast<const char *>(values_.data()), values_.size() * sizeof(float));
+    }
+
+    void Load(std::ifstream &in) {
+        uint32_t header[3];
+        if (!ReadHeader(in, header)) return;
+        in.read(reinterpret_cast<char *>(directory_.data()), directory_.size() * sizeof(SparseGroup));
+        in.ignore(header[2]);
+        values_.Reset(size_t(header[1]) * block_size);
+        in.read(reinterpret_cast<char *>(values_.data()), values_.size() * sizeof(float));
+    }
+
+    void Map(WeightCursor &in) {
+        uint32_t header[3];
+        in.Read(header, sizeof(header));
+        if (!in || header[0] != size_) {
+            in.failed = true;
+            return;
+        }
+        directory_.Map(in);
+        in.Take(header[2]);
+        values_.Reset(size_t(header[1]) * block_size);
+        values_.Map(in);
+    }
+
+    void Place(const WeightPlacement &placement) {
+        directory_.Place(placement);
+        values_.Place(placement);
+    }
+
+    void Memory(WeightMemory &memory) const {
+        directory_.Memory(memory);
+        values_.Memory(memory);
+    }
+
+private:
+    bool ReadHeader(std::ifstream &in, uint32_t header[3]) {
+        in.read(reinterpret_cast<char *>(header), 3 * sizeof(uint32_t));
+        if (in && header[0] != size_) in.setstate(std::ios::failbit);
+        return bool(in);
+    }
+
+    size_t size_;
+    WeightTable<SparseGroup> directory_;
+    WeightTable<float> values_;
+};
+
+static void SaveWeights(std::ofstream &out, WeightTable<Sparse> &table, float scale) {
+    table.Save(out);
+}
+
+static void LoadWeights(std::ifstream &in, WeightTable<Sparse> &table, float &scale) {
+    scale = 1.0f;
+    table.Load(in);
+}
+
+static void MapWeights(WeightCursor &in, WeightTable<Sparse> &table, float &scale) {
+    scale = 1.0f;
+    table.Map(in);
+}
+
+/**
+ * read n float weights from a float weight file and write them as one sparse table
+ */
+template<>
+void QuantizeWeights<Sparse>(std::ifstream &in, std::ofstream &out, size_t n) {
+    std::vector<float> values(n);
+    in.read(reinterpret_cast<char *>(&values[0]), n * sizeof(float));
+
+    WeightTable<Sparse> table(n);
+    table.Build(values.data());
+    table.Save(out);
+}
@@ -0,0 +1,174 @@
+//
+// The stage networks of an agent, loaded when its games first need them
+//
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "NTupleNetwork.h"
+#include "WeightRegistry.h"
+
+/**
+ * the networks an agent picks between by max tile (see GetTupleId)
+ * most games stay in stage 0 for a long time and many never reach the last stage, so a stage is loaded on
+ * its first use, or ahead of it in the background once Prefetch sees the max tile close to its threshold
+ * the lazy loads report on std::clog, std::cout carries the arena protocol
+ * operator[] may be called from the threads of a parallel search, a stage is resolved once under a lock
+ * with numa=replicate every stage has a copy on each NUMA node, and operator[] returns the copy of the node the
+ * calling thread runs on (search workers are pinned to their nodes, see ThreadPool); learning keeps one copy
+ */
+class StageNetworks {
+public:
+    StageNetworks(int stages, const std::string &type, const WeightPlacement &placement, bool verify)
+            : type_(type), placement_(placement), verify_(verify), networks_(stages), pending_(stages),
+              resolved_(new std::atomic<bool>[stages]()) {}
+
+    /**
+     * the stages come from file_name (see WeightRegistry::Load), loaded on first use unless lazy is false
+     * without a file they start at zero
+     * a lazy load still checks every stage file now (and verifies it, if asked), only the mapping waits,
+     * so a broken file stops the program here and not in the middle of a game
+     */
+    void Load(const std::string &file_name, bool lazy) {
+        file_name_ = file_name;
+        // Verify covers every stage of a container, so it runs once here and not for each stage
+        if (verify_ && !file_name.empty() && !WeightRegistry::Check(file_name, 0, type_, true)) std::exit(-1);
+        verify_ = false;
+        for (int stage = 0; lazy && !file_name.empty() && stage < size(); stage++) {
+            if (!WeightRegistry::Check(file_name, stage, type_)) std::exit(-1);
+        }
+
+        for (int stage = 0; !lazy && stage < size(); stage++) {
+            std::cout << "Loading " << file_name << " stage " << stage << std::endl;
+            networks_[stage] = Create(stage);
+            if (networks_[stage].empty()) std::exit(-1);
+            std::cout << "Loaded " << stage << " tuple" << std::endl;
+        }
+    }
+
+    int size() const { return int(networks_.size()); }
+
+    ValueNetwork &operator[](int stage) {
+        if (!resolved_[stage].load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(resolve_mutex_);
+            if (networks_[stage].empty()) Resolve(stage);
+            resolved_[stage].store(true, std::memory_order_release);
+        }
+        const Replicas &replicas = networks_[stage];
+        return *replicas[replicas.size() > 1 ? CurrentNumaIndex() % replicas.size() : 0];
+    }
+
+    /**
+     * start loading stage in the background, if it is neither loaded nor on its way
+     */
+    void Prefetch(int stage) {
+        if (stage >= size() || !networks_[stage].empty() || pending_[stage].valid()) return;
+        pending_[stage] = std::async(std::launch::async, [this, stage] { return Create(stage); });
+    }
+
+    /**
+     * the network of stage, copied first if other agents share it or it is a read-only map (copy on write)
+     * the other copies of a replicated stage are dropped, they would not see the updates
+     */
+    ValueNetwork &Writable(int stage) {
+        if (networks_[stage].empty()) Resolve(stage);
+        networks_[stage].resize(1);
+        std::shared_ptr<ValueNetwork> &network = networks_[stage][0];
+        if (network.use_count() > 1 || network->ReadOnly()) {
+            network = network->WritableCopy();
+        }
+        return *network;
+    }
+
+    /**
+     * bytes per feature and stage, mapped (the address space the tables take) against resident (in memory)
+     */
+    std::string MemoryReport() const {
+        std::stringstream report;
+        size_t total_mapped = 0, total_resident = 0;
+
+        for (int stage = 0; stage < size(); stage++) {
+            report << "stage " << stage << ": ";
+            if (networks_[stage].empty()) {
+                report << (pending_[stage].valid() ? "loading" : "not loaded") << "; ";
+                continue;
+            }
+
+            size_t mapped = 0, resident = 0;
+            for (auto &network : networks_[stage]) {
+                for (auto &feature : network->Memory()) {
+                    report << feature.first << " " << feature.second.Bytes() << "/" << feature.second.resident
+                           << ", ";
+                    mapped += feature.second.Bytes();
+                    resident += feature.second.resident;
+                }
+            }
+            report << "total " << mapped << "/" << resident << " bytes mapped/resident ("
+                   << Describe(networks_[stage][0]->Backing());
+            if (networks_[stage].size() > 1) report << ", " << networks_[stage].size() << " copies";
+            report << "); ";
+            total_mapped += mapped;
+            total_resident += resident;
+        }
+        report << "all stages " << total_mapped << "/" << total_resident << " bytes mapped/resident";
+
+        return report.str();
+    }
+
+private:
+    // the copies of a stage, one per NUMA node when replicated
+    typedef std::vector<std::shared_ptr<ValueNetwork>> Replicas;
+
+    /**
+     * the copies of stage, none if it cannot be loaded
+     */
+    Replicas Create(int stage) {
+        size_t copies = placement_.replicate ? NumaNodes().size() : 1;
+        Replicas replicas;
+        for (size_t i = 0; i < copies; i++) {
+            WeightPlacement placement = placement_;
+            if (copies > 1) placement.node = NumaNodes()[i];
+
+            std::shared_ptr<ValueNetwork> network;
+            if (file_name_.empty()) {
+                network = std::make_shared<ValueNetwork>(type_);
+                network->Place(placement);
+            } else {
+                network = WeightRegistry::Load(file_name_, stage, type_, placement);
+            }
+            if (!network) return Replicas();
+            replicas.push_back(network);
+        }
+        return replicas;
+    }
+
+    /**
+     * the network of stage from its background load, or loaded now
+     */
+    void Resolve(int stage) {
+        if (pending_[stage].valid()) {
+            networks_[stage] = pending_[stage].get();
+        } else {
+            if (!file_name_.empty()) std::clog << "Loading " << file_name_ << " stage " << stage << std::endl;
+            networks_[stage] = Create(stage);
+        }
+        if (networks_[stage].empty()) std::exit(-1);
+    }
+
+    std::string file_name_;
+    std::string type_;
+    WeightPlacement placement_;
+    bool verify_;
+    std::vector<Replicas> networks_;
+    std::vector<std::future<Replicas>> pending_;
+    std::unique_ptr<std::atomic<bool>[]> resolved_;
+    std::mutex resolve_mutex_;
+};
@@ -0,0 +1,62 @@
+/**
+ * Lookup table generator for Threes
+ * runs GenerateLookUpTables once at build time and writes the result as constant arrays,
+ * so the tables live in .rodata and nothing has to be computed at startup
+ *
+ * usage: ./tablegen > LookUpTableData.h
+ * built with -DTHREES_COMPACT_TABLES it writes the compact set instead: ./tablegen > LookUpTableCompactData.h
+ */
+
+#define THREES_TABLE_GEN
+
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+
+#include "Common.h"
+#include "LookUpTable.h"
+
+static inline void EmitValue(FILE *out, cell_t v) { std::fprintf(out, "%u", unsigned(v)); }
+
+static inline void EmitValue(FILE *out, row_t v) { std::fprintf(out, "0x%04x", unsigned(v)); }
+
+static inline void EmitValue(FILE *out, uint32_t v) { std::fprintf(out, "0x%08x", unsigned(v)); }
+
+static inline void EmitValue(FILE *out, board_t v) { std::fprintf(out, "0x%016" PRIx64 "ULL", v); }
+
+// 17 significant digits reproduce the float exactly once it goes through double
+static inline void EmitValue(FILE *out, float v) { std::fprintf(out, "%.17g", double(v)); }
+
+static inline void EmitValue(FILE *out, const LineMove &v) {
+    std::fprintf(out, "{");
+    EmitValue(out, v.unpacked);
+    std::fprintf(out, ", ");
+    EmitValue(out, v.reward);
+    std::fprintf(out, ", ");
+    EmitValue(out, v.delta);
+    std::fprintf(out, "}");
+}
+
+template<typename type>
+static void EmitTable(FILE *out, const char *type_name, const char *name, const type *table) {
+    std::fprintf(out, "static const %s %s[65536] = {\n", type_name, name);
+    for (unsigned i = 0; i < 65536; i++) {
+        std::fprintf(out, (i % 8 == 0) ? "    " : " ");
+        EmitValue(out, table[i]);
+        std::fprintf(out, (i % 8 == 7) ? ",\n" : ",");
+    }
+    std::fprintf(out, "};\n\n");
+}
+
+int main() {
+    std::unique_ptr<LookUpTableSet> tables(new LookUpTableSet());
+    GenerateLookUpTables(*tables);
+
+    std::printf("// Generated by TableGen.cpp, do not edit.\n");
+    std::printf("#pragma once\n\n");
+#define THREES_EMIT_TABLE(type, name) EmitTable(stdout, #type, #name, tables->name);
+    THREES_LOOKUP_TABLES(THREES_EMIT_TABLE)
+#undef THREES_EMIT_TABLE
+
+    return 0;
+}
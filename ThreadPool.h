@@ -0,0 +1,194 @@
+//
+// A work-stealing thread pool for the fork-join parallelism of the search
+//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Numa.h"
+
+/**
+ * threads - 1 workers and the thread that calls ParallelFor, each with its own stack of jobs
+ * a job is one call of ParallelFor, kept on the stack of the calling thread until all its tasks are done; a thread
+ * takes the next task of the newest job of its own stack first and steals from the oldest job of another stack when
+ * its own has nothing left; the oldest jobs are the ones forked nearest to the root, the largest to steal
+ * ParallelFor runs tasks until its own are done, so tasks fork tasks of their own without blocking a thread;
+ * when there is nothing left to take, a worker sleeps until a job is pushed and ParallelFor until the last of its
+ * tasks finishes; a push wakes a worker per task, but no more than keep the awake threads to the hardware threads,
+ * so a pool larger than the machine runs its tasks on the threads that are already running
+ * pin puts worker i on the CPUs of NUMA node i % nodes, on hosts with more than one node
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads, bool pin = false)
+            : queues_(new Queue[threads]), size_(threads), pin_(pin && NumaNodes().size() > 1),
+              hardware_(int(std::max(1u, std::thread::hardware_concurrency()))), queued_(0), awake_(threads),
+              stop_(false) {
+        for (int index = 1; index < threads; index++) {
+            workers_.emplace_back([this, index] { Work(index); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &worker : workers_) worker.join();
+    }
+
+    int size() const { return size_; }
+
+    /**
+     * the index of this thread in this pool, 0 for a thread that is not one of its workers
+     */
+    int WorkerIndex() const { return CurrentWorker().pool == this ? CurrentWorker().index : 0; }
+
+    /**
+     * task(i) for i in 0..count on the pool, returns when all of them finished
+     */
+    template<typename Task>
+    void ParallelFor(int count, const Task &task) {
+        Job job(count, &task, [](const void *task, int i) { (*static_cast<const Task *>(task))(i); });
+        Queue &queue = queues_[WorkerIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.size == max_jobs) {
+                // nested deeper than a search forks, run in place
+                for (int i = 0; i < count; i++) task(i);
+                return;
+            }
+            queue.jobs[queue.size++] = &job;
+        }
+        queued_.fetch_add(count, std::memory_order_relaxed);
+        Wake(count - 1);
+
+        while (job.remaining.load(std::memory_order_acquire) != 0) {
+            if (RunOne(WorkerIndex())) continue;
+
+            // all tasks are taken, the others are running them
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            awake_--;
+            if (queued_.load(std::memory_order_relaxed) > 0) wake_.notify_one();
+            job.done.wait(lock, [&job] { return job.remaining.load(std::memory_order_acquire) == 0; });
+            awake_++;
+        }
+        {
+            // the thread that finished the last task may still be notifying done
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+
+        // the jobs this thread pushed since are finished and gone, this one is on top
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.size--;
+    }
+
+private:
+    static const int max_jobs = 64;
+
+    /**
+     * the tasks of one ParallelFor, on its stack frame: next is the first task nobody took yet
+     */
+    struct Job {
+        Job(int count, const void *task, void (*run)(const void *, int))
+                : count(count), task(task), run(run), next(0), remaining(count) {}
+
+        int count;
+        const void *task;
+        void (*run)(const void *, int);
+        int next; // under the mutex of the queue
+        std::atomic<int> remaining;
+        std::condition_variable done;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::array<Job *, max_jobs> jobs;
+        int size = 0;
+    };
+
+    struct Worker {
+        const ThreadPool *pool;
+        int index;
+    };
+
+    static Worker &CurrentWorker() {
+        static thread_local Worker worker = {nullptr, 0};
+        return worker;
+    }
+
+    /**
+     * runs the next task of the newest job of queue index, or of the oldest job of another queue;
+     * false if there was none
+     */
+    bool RunOne(int index) {
+        Job *job = nullptr;
+        int task = 0;
+        for (int k = 0; k < size_ && !job; k++) {
+            Queue &queue = queues_[(index + k) % size_];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            for (int j = 0; j < queue.size && !job; j++) {
+                Job *candidate = queue.jobs[k == 0 ? queue.size - 1 - j : j];
+                if (candidate->next == candidate->count) continue;
+                job = candidate;
+                task = job->next++;
+            }
+        }
+        if (!job) return false;
+
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        job->run(job->task, task);
+
+        // the last task finishes under the lock the owner sleeps on, so the job outlives the notification
+        int remaining = job->remaining.load(std::memory_order_relaxed);
+        while (remaining > 1 && !job->remaining.compare_exchange_weak(remaining, remaining - 1,
+                                                                      std::memory_order_acq_rel)) {}
+        if (remaining == 1) {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            job->remaining.fetch_sub(1, std::memory_order_acq_rel);
+            job->done.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * wakes up to count sleeping workers, as many as there are hardware threads nobody is awake on
+     */
+    void Wake(int count) {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        for (int i = 0; i < count && awake_ + i < hardware_; i++) wake_.notify_one();
+    }
+
+    void Work(int index) {
+        CurrentWorker() = {this, index};
+        if (pin_) PinToNumaNode(index % int(NumaNodes().size()));
+        while (true) {
+            if (RunOne(index)) continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            awake_--;
+            wake_.wait(lock, [this] { return stop_ || queued_.load(std::memory_order_relaxed) > 0; });
+            awake_++;
+            if (stop_) return;
+        }
+    }
+
+    std::unique_ptr<Queue[]> queues_;
+    int size_;
+    bool pin_;
+    int hardware_;
+    std::vector<std::thread> workers_;
+    std::atomic<int> queued_;
+    int awake_; // threads not sleeping, under sleep_mutex_
+    bool stop_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+};
@@ -12,6 +12,7 @@
 #include "Statistic.h"
 #include "arena.h"
 #include "io.h"
+#include "Benchmark.h"
 
 // 0 1 2 3 4 5   6   7   8   9   10  11  12   13   14
 // 0 1 2 3 6 12  24  48  92  192 384 768 1536 3072 6144
@@ -41,6 +42,7 @@ int shell(int argc, const char *argv[]) {
     }
 
     std::cout << "LOADED SETTING" << std::endl;
+    WeightRegistry::ReportMemory(std::cout);
 
     std::regex match_move("^#\\S+ \\S+$"); // e.g. "#M0001 ?", "#M0001 #U"
     std::regex match_ctrl("^#\\S+ \\S+ \\S+$"); // e.g. "#M0001 open Slider:Placer", "#M0001 close score=15424"
@@ -143,8 +145,6 @@ int shell(int argc, const char *argv[]) {
 }
 
 int main(int argc, const char *argv[]) {
-    InitLookUpTables();
-
     std::cout << "Threes-Demo: ";
     std::copy(argv, argv + argc, std::ostream_iterator<const char *>(std::cout, " "));
     std::cout << std::endl << std::endl;
@@ -188,6 +188,26 @@ int main(int argc, const char *argv[]) {
             summary = true;
         } else if (para.find("--shell") == 0) {
             return shell(argc, argv);
+        } else if (para.find("--bench=") == 0) {
+            return Benchmark(para.substr(para.find("=") + 1)).Run();
+        } else if (para.find("--quantize=") == 0) {
+            std::map<std::string, std::string> options;
+            std::stringstream ss(para.substr(para.find("=") + 1));
+            for (std::string pair; ss >> pair;) {
+                options[pair.substr(0, pair.find('='))] = pair.substr(pair.find('=') + 1);
+            }
+            return QuantizeWeightFile(options["in"], options["out"], options["type"]);
+        } else if (para.find("--weights=") == 0) {
+            std::map<std::string, std::string> options;
+            std::stringstream ss(para.substr(para.find("=") + 1));
+            std::string command;
+            ss >> command;
+            for (std::string pair; ss >> pair;) {
+                options[pair.substr(0, pair.find('='))] = pair.substr(pair.find('=') + 1);
+            }
+            return WeightFileTool(command, options);
+        } else if (para.find("--check-tables") == 0) {
+            return VerifyLookUpTables() ? 0 : 1;
         }
     }
 
@@ -202,6 +222,7 @@ int main(int argc, const char *argv[]) {
 
     Player player(play_args);
     DareDevil evil(evil_args);
+    WeightRegistry::ReportMemory(std::cout);
 
     while (!stat.IsFinished()) {
         player.OpenEpisode("~:" + evil.name());
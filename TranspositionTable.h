@@ -0,0 +1,143 @@
+//
+// The transposition table of the expectimax search, shared by the moves of a game
+//
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include "Board64.h"
+
+/**
+ * the results of searched max nodes, keyed on the board, the bag and the hint, so a subtree that another order of
+ * moves reaches again is looked up instead of searched again
+ * an entry is only used at the depth it was searched to, so a search returns exactly what it returns without the
+ * table; entries are stamped with the generation of the move that stored them, NewGeneration is called once per
+ * move and the entries of earlier moves stay usable until they are replaced
+ * a bucket is one cache line of 4 entries, an entry two words, the key xor the data and the data, read and written
+ * without locks: an entry torn by two writers fails the key check and is a miss
+ */
+class TranspositionTable {
+public:
+    /**
+     * the largest power of two buckets that fits in megabytes, at least one
+     */
+    explicit TranspositionTable(size_t megabytes) : buckets_(nullptr, std::free), mask_(0), generation_(0) {
+        size_t count = 1;
+        while (count * 2 * sizeof(Bucket) <= megabytes << 20) count *= 2;
+
+        void *memory = nullptr;
+        if (posix_memalign(&memory, sizeof(Bucket), count * sizeof(Bucket)) != 0) {
+            std::cerr << "cannot allocate a transposition table of " << megabytes << " MB" << std::endl;
+            std::exit(-1);
+        }
+        buckets_.reset(static_cast<Bucket *>(memory));
+        mask_ = count - 1;
+        Clear();
+    }
+
+    size_t Bytes() const { return (mask_ + 1) * sizeof(Bucket); }
+
+    void Clear() { std::memset(buckets_.get(), 0, Bytes()); }
+
+    // not while a search is running
+    void NewGeneration() { generation_ = (generation_ + 1) & 0xffff; }
+
+    /**
+     * the direction and value stored for the max node board, bag and hint at depth, if there is one
+     */
+    bool Probe(Board64 board, const std::array<int, 4> &bag, int hint, int depth, std::pair<int, float> &result) {
+        uint64_t key = Key(board, bag, hint);
+        Bucket &bucket = buckets_.get()[key & mask_];
+
+        for (Entry &entry : bucket.entries) {
+            uint64_t data = __atomic_load_n(&entry.data, __ATOMIC_RELAXED);
+            uint64_t check = __atomic_load_n(&entry.check, __ATOMIC_RELAXED);
+            if ((check ^ data) != key || DepthOf(data) != depth) continue;
+
+            uint32_t bits = uint32_t(data);
+            std::memcpy(&result.second, &bits, sizeof(float));
+            result.first = int((data >> 40) & 0xff) - 1;
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * replaces the entry of the same key, else an empty one, else the least useful: entries of earlier moves
+     * before those of this move, the shallowest first
+     */
+    void Store(Board64 board, const std::array<int, 4> &bag, int hint, int depth, const std::pair<int, float> &result) {
+        uint64_t key = Key(board, bag, hint);
+        Bucket &bucket = buckets_.get()[key & mask_];
+
+        uint32_t bits;
+        std::memcpy(&bits, &result.second, sizeof(float));
+        uint64_t data = uint64_t(bits) | uint64_t(depth & 0xff) << 32 | uint64_t((result.first + 1) & 0xff) << 40
+                        | uint64_t(generation_) << 48;
+
+        Entry *victim = &bucket.entries[0];
+        int victim_rank = Rank(*victim);
+        for (Entry &entry : bucket.entries) {
+            uint64_t old = __atomic_load_n(&entry.data, __ATOMIC_RELAXED);
+            uint64_t check = __atomic_load_n(&entry.check, __ATOMIC_RELAXED);
+            if ((check ^ old) == key) {
+                // the same node searched again, keep the deeper result of this move
+                if (GenerationOf(old) == generation_ && DepthOf(old) > depth) return;
+                victim = &entry;
+                break;
+            }
+            if (Rank(entry) < victim_rank) {
+                victim = &entry;
+                victim_rank = Rank(entry);
+            }
+        }
+
+        __atomic_store_n(&victim->data, data, __ATOMIC_RELAXED);
+        __atomic_store_n(&victim->check, key ^ data, __ATOMIC_RELAXED);
+    }
+
+private:
+    struct Entry {
+        uint64_t check; // key ^ data
+        uint64_t data;  // value bits, depth << 32, (direction + 1) << 40, generation << 48
+    };
+
+    struct alignas(64) Bucket {
+        Entry entries[4];
+    };
+
+    /**
+     * a 64-bit hash of board, bag[1..3] and hint, the splitmix64 finalizer over the board xor the rest
+     */
+    static uint64_t Key(Board64 board, const std::array<int, 4> &bag, int hint) {
+        uint64_t rest = uint64_t(bag[1]) | uint64_t(bag[2]) << 4 | uint64_t(bag[3]) << 8 | uint64_t(hint) << 12;
+        uint64_t x = uint64_t(board.GetBoard()) ^ ((rest + 1) * 0x9e3779b97f4a7c15ULL);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static int DepthOf(uint64_t data) { return int((data >> 32) & 0xff); }
+
+    static unsigned GenerationOf(uint64_t data) { return unsigned(data >> 48); }
+
+    /**
+     * how much an entry is worth keeping: empty, then of an earlier move, then by depth
+     */
+    int Rank(const Entry &entry) const {
+        uint64_t data = __atomic_load_n(&entry.data, __ATOMIC_RELAXED);
+        if (data == 0) return -1;
+        return (GenerationOf(data) == generation_ ? 256 : 0) + DepthOf(data);
+    }
+
+    std::unique_ptr<Bucket, void (*)(void *)> buckets_;
+    size_t mask_;
+    unsigned generation_;
+};
@@ -0,0 +1,412 @@
+//
+// The weight container: every stage of a network in one file, behind a header that describes and checks them
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NTupleNetwork.h"
+
+/**
+ * a legacy weight file holds one stage as a raw dump of its features, and the stage index is spliced into
+ * the name: weight.bin names weight0.bin, weight1.bin, ...
+ */
+static std::string LegacyStageFileName(std::string file_name, int stage) {
+    file_name.insert(file_name.size() - 4, std::to_string(stage));
+    return file_name;
+}
+
+/**
+ * the container, little endian as the weights themselves:
+ *   a header of header_bytes, below
+ *   the stages, each starting on a 4 KB boundary so it can be mapped in place, laid out as in a legacy file
+ * the checksum of a stage is FNV-1a over the FNV-1a hashes of its chunks of chunk_bytes,
+ * so the chunks can be hashed in parallel
+ */
+struct WeightFileStage {
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t checksum;
+};
+
+struct WeightFileHeader {
+    static const int max_stages = 16;
+
+    char magic[8];                 // "THREESNT"
+    uint32_t version;
+    uint32_t stage_count;
+    uint64_t chunk_bytes;
+    char type[16];                 // the weight type, see ValueNetwork
+    char layout[1024];             // TupleNetwork::Layout() of every stage
+    WeightFileStage stages[max_stages];
+    uint64_t header_checksum;      // of the bytes above
+};
+
+class WeightFile {
+public:
+    static const uint32_t version = 1;
+    static const size_t header_bytes = 4096;
+    static const size_t chunk_bytes = 16 * 1024 * 1024;
+
+    /**
+     * 64-bit FNV-1a over the words of data, the tail padded with zeros
+     */
+    static uint64_t Hash(const char *data, size_t bytes, uint64_t hash = 0xcbf29ce484222325ULL) {
+        size_t words = bytes / sizeof(uint64_t);
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word;
+            std::memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+            hash = (hash ^ word) * 0x100000001b3ULL;
+        }
+        if (bytes % sizeof(uint64_t)) {
+            uint64_t word = 0;
+            std::memcpy(&word, data + words * sizeof(uint64_t), bytes % sizeof(uint64_t));
+            hash = (hash ^ word) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    /**
+     * the checksum of a stage, its chunks hashed by one thread per core
+     */
+    static uint64_t Checksum(const char *data, size_t bytes, size_t chunk) {
+        size_t chunks = (bytes + chunk - 1) / chunk;
+        std::vector<uint64_t> hashes(chunks);
+        size_t workers = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), chunks));
+
+        auto hash_chunks = [&](size_t first) {
+            for (size_t i = first; i < chunks; i += workers) {
+                hashes[i] = Hash(data + i * chunk, std::min(chunk, bytes - i * chunk));
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t w = 1; w < workers; w++) threads.emplace_back(hash_chunks, w);
+        hash_chunks(0);
+        for (std::thread &thread : threads) thread.join();
+
+        return Hash(reinterpret_cast<const char *>(hashes.data()), hashes.size() * sizeof(uint64_t));
+    }
+
+    /**
+     * true if file_name starts with the container magic, legacy files are raw weights
+     */
+    static bool IsContainer(const std::string &file_name) {
+        std::ifstream in(file_name, std::ios::in | std::ios::binary);
+        char magic[8] = {};
+        in.read(magic, sizeof(magic));
+        return in && std::memcmp(magic, "THREESNT", sizeof(magic)) == 0;
+    }
+
+    /**
+     * read and check the header: magic, version, header checksum, and that every stage lies inside the file
+     * error says what is wrong if it returns false
+     */
+    bool Open(const std::string &file_name, std::string &error) {
+        file_name_ = file_name;
+        std::ifstream in(file_name, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!in.is_open()) {
+            error = "cannot open " + file_name;
+            return false;
+        }
+        uint64_t file_bytes = uint64_t(in.tellg());
+        in.seekg(0);
+        in.read(reinterpret_cast<char *>(&header_), sizeof(header_));
+
+        if (!in || std::memcmp(header_.magic, "THREESNT", sizeof(header_.magic)) != 0) {
+            error = file_name + " is not a weight container";
+        } else if (header_.version != version) {
+            error = file_name + " has version " + std::to_string(header_.version) + ", expected "
+                    + std::to_string(version);
+        } else if (header_.header_checksum != HeaderChecksum(header_)) {
+            error = file_name + " has a corrupt header";
+        } else if (header_.stage_count > WeightFileHeader::max_stages || header_.chunk_bytes == 0) {
+            error = file_name + " has a corrupt header";
+        } else {
+            for (uint32_t i = 0; i < header_.stage_count; i++) {
+                const WeightFileStage &stage = header_.stages[i];
+                if (stage.offset < header_bytes || stage.offset + stage.bytes > file_bytes) {
+                    error = file_name + " is truncated, stage " + std::to_string(i) + " ends past the end of the file";
+                    return false;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * whether stage holds a network of the given type, error says why not
+     */
+    bool Fits(int stage, const std::string &type, std::string &error) const {
+        if (stage < 0 || uint32_t(stage) >= header_.stage_count) {
+            error = file_name_ + " has " + std::to_string(header_.stage_count) + " stages, no stage "
+                    + std::to_string(stage);
+        } else if (Type() != type) {
+            error = file_name_ + " holds " + Type() + " weights, not " + type;
+        } else if (Layout() != ValueNetwork::Layout(type)
+                   || (ValueNetwork::Bytes(type) && header_.stages[stage].bytes != ValueNetwork::Bytes(type))) {
+            error = file_name_ + " was written for another network: " + Layout();
+        } else {
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * compare the checksums of every stage, reading the file through a read-only map
+     */
+    bool Verify(std::string &error) const {
+        std::shared_ptr<MappedWeightFile> file = MappedWeightFile::Open(file_name_, false);
+        if (!file) {
+            error = "cannot map " + file_name_;
+            return false;
+        }
+        for (uint32_t i = 0; i < header_.stage_count; i++) {
+            const WeightFileStage &stage = header_.stages[i];
+            if (Checksum(file->data() + stage.offset, stage.bytes, header_.chunk_bytes) != stage.checksum) {
+                error = file_name_ + " fails the checksum of stage " + std::to_string(i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int StageCount() const { return int(header_.stage_count); }
+
+    const WeightFileStage &Stage(int stage) const { return header_.stages[stage]; }
+
+    std::string Type() const { return std::string(header_.type, strnlen(header_.type, sizeof(header_.type))); }
+
+    std::string Layout() const {
+        return std::string(header_.layout, strnlen(header_.layout, sizeof(header_.layout)));
+    }
+
+    /**
+     * write a container of stage_count stages of the given type: write_stage(i, out) writes stage i at the
+     * position of out, the checksums are computed from the file once it is written
+     * every stage starts on a 4 KB boundary and is as long as write_stage made it (sparse stages vary in size)
+     * the file is written next to file_name and renamed over it, the old one may still be mapped
+     */
+    static bool Write(const std::string &file_name, const std::string &type, int stage_count,
+                      const std::function<bool(int, std::ofstream &)> &write_stage) {
+        WeightFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "THREESNT", sizeof(header.magic));
+        header.version = version;
+        header.stage_count = uint32_t(stage_count);
+        header.chunk_bytes = chunk_bytes;
+        std::string layout = ValueNetwork::Layout(type);
+        if (stage_count > WeightFileHeader::max_stages || type.size() >= sizeof(header.type)
+            || layout.size() >= sizeof(header.layout)) {
+            std::cerr << "cannot describe " << stage_count << " stages of " << type << " in a weight file" << std::endl;
+            return false;
+        }
+        std::memcpy(header.type, type.data(), type.size());
+        std::memcpy(header.layout, layout.data(), layout.size());
+
+        std::string temp_name = file_name + ".tmp";
+        std::ofstream out(temp_name, std::ios::out | std::ios::binary);
+        if (!out.is_open()) {
+            std::cerr << "cannot open " << temp_name << std::endl;
+            return false;
+        }
+        // a failed write leaves no half-written file next to the target
+        auto discard = [&out, &temp_name] {
+            if (out.is_open()) out.close();
+            std::remove(temp_name.c_str());
+            return false;
+        };
+        std::vector<char> zeros(header_bytes, 0);
+        for (int i = 0; i < stage_count; i++) {
+            WeightFileStage &stage = header.stages[i];
+            uint64_t position = uint64_t(out.tellp());
+            stage.offset = i ? (position + 4095) / 4096 * 4096 : header_bytes;
+            out.write(zeros.data(), std::streamsize(stage.offset - position)); // header and padding
+            bool written = write_stage(i, out);
+            stage.bytes = uint64_t(out.tellp()) - stage.offset;
+            if (!written || !out || (ValueNetwork::Bytes(type) && stage.bytes != ValueNetwork::Bytes(type))) {
+                std::cerr << "stage " << i << " of " << file_name << " was not written in full" << std::endl;
+                return discard();
+            }
+        }
+        out.close();
+        if (!out) return discard();
+
+        std::shared_ptr<MappedWeightFile> file = MappedWeightFile::Open(temp_name, false);
+        if (!file) return discard();
+        for (int i = 0; i < stage_count; i++) {
+            WeightFileStage &stage = header.stages[i];
+            stage.checksum = Checksum(file->data() + stage.offset, stage.bytes, header.chunk_bytes);
+        }
+        file.reset();
+        header.header_checksum = HeaderChecksum(header);
+
+        std::fstream patch(temp_name, std::ios::in | std::ios::out | std::ios::binary);
+        patch.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        patch.close();
+        if (!patch || std::rename(temp_name.c_str(), file_name.c_str()) != 0) return discard();
+        return true;
+    }
+
+private:
+    static uint64_t HeaderChecksum(const WeightFileHeader &header) {
+        return Hash(reinterpret_cast<const char *>(&header), offsetof(WeightFileHeader, header_checksum));
+    }
+
+    std::string file_name_;
+    WeightFileHeader header_{};
+};
+
+static_assert(sizeof(WeightFileHeader) <= WeightFile::header_bytes, "the weight file header outgrew its block");
+
+/**
+ * how much of each table of a float stage a trained network actually wrote: non-zero weights, non-zero blocks
+ * of 16 (what a sparse table keeps, see SparseTable.h), and the size of the table dense and sparse
+ */
+static int WeightOccupancy(const std::string &file_name, int stage) {
+    uint64_t offset = 0;
+    if (WeightFile::IsContainer(file_name)) {
+        WeightFile file;
+        std::string error;
+        if (!file.Open(file_name, error) || !file.Fits(stage, "float", error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        offset = file.Stage(stage).offset;
+    }
+
+    std::ifstream in(file_name, std::ios::in | std::ios::binary);
+    in.seekg(std::streamoff(offset));
+    std::stringstream layout(NTupleNetwork::Layout());
+    size_t total_dense = 0, total_sparse = 0;
+    std::cout << std::fixed << std::setprecision(2);
+
+    // every block of the layout is "name:float:n" or "name:float:<tables>x<n>"
+    for (std::string block; layout >> block;) {
+        std::string name = block.substr(0, block.find(':')), count = block.substr(block.rfind(':') + 1);
+        size_t tables = count.find('x') == std::string::npos ? 1 : std::stoull(count.substr(0, count.find('x')));
+        size_t n = std::stoull(count.substr(count.find('x') + 1));
+
+        std::vector<float> weights(n);
+        for (size_t t = 0; t < tables; t++) {
+            in.read(reinterpret_cast<char *>(weights.data()), n * sizeof(float));
+            if (!in) {
+                std::cerr << file_name << " ends inside " << name << std::endl;
+                return 1;
+            }
+
+            const size_t block_size = WeightTable<Sparse>::block_size, group_size = WeightTable<Sparse>::group_size;
+            size_t nonzero = 0, blocks = 0;
+            for (size_t first = 0; first < n; first += block_size) {
+                size_t kept = 0;
+                for (size_t i = first; i < std::min(n, first + block_size); i++) kept += weights[i] != 0.0f;
+                nonzero += kept;
+                blocks += kept != 0;
+            }
+            size_t dense = n * sizeof(float);
+            size_t sparse = 3 * sizeof(uint32_t) + (n + group_size - 1) / group_size * sizeof(SparseGroup)
+                            + blocks * block_size * sizeof(float);
+            total_dense += dense;
+            total_sparse += SparseTupleNetwork::Layout().find(name + ":sparse") != std::string::npos ? sparse : dense;
+
+            std::cout << name << (tables > 1 ? "[" + std::to_string(t) + "]" : "") << ": "
+                      << 100.0 * nonzero / n << "% weights, "
+                      << 100.0 * blocks / ((n + block_size - 1) / block_size) << "% blocks non-zero, "
+                      << dense / 1048576.0 << " MB dense, " << sparse / 1048576.0 << " MB sparse" << std::endl;
+        }
+    }
+    std::cout << "total: " << total_dense / 1048576.0 << " MB dense, " << total_sparse / 1048576.0
+              << " MB as a sparse stage, where only the pattern tables are sparse" << std::endl;
+    return 0;
+}
+
+/**
+ * the conversions between legacy stage files and containers
+ * usage: ./threes --weights="pack in=weight.bin out=weight.tnw [stages=3] [type=float]"
+ *        ./threes --weights="unpack in=weight.tnw out=weight.bin"
+ *        ./threes --weights="verify in=weight.tnw"
+ *        ./threes --weights="occupancy in=weight0.bin" (or in=weight.tnw [stage=0])
+ * pack reads weight0.bin, weight1.bin, ... (see LegacyStageFileName), unpack writes them
+ */
+static int WeightFileTool(const std::string &command, std::map<std::string, std::string> options) {
+    const std::string &in_name = options["in"], &out_name = options["out"];
+
+    if (command == "pack") {
+        std::string type = options.count("type") ? options["type"] : "float";
+        int stages = options.count("stages") ? std::stoi(options["stages"]) : 3;
+        size_t bytes = ValueNetwork::Bytes(type);
+
+        for (int i = 0; i < stages; i++) {
+            std::string stage_name = LegacyStageFileName(in_name, i);
+            std::ifstream in(stage_name, std::ios::in | std::ios::binary | std::ios::ate);
+            if (!in.is_open() || (bytes && size_t(in.tellg()) != bytes)) {
+                std::cerr << stage_name << " is not a " << type << " stage of " << bytes << " bytes" << std::endl;
+                return 1;
+            }
+        }
+
+        bool written = WeightFile::Write(out_name, type, stages, [&](int i, std::ofstream &out) {
+            std::ifstream in(LegacyStageFileName(in_name, i), std::ios::in | std::ios::binary);
+            out << in.rdbuf();
+            return bool(out);
+        });
+        return written ? 0 : 1;
+    }
+
+    if (command == "occupancy") {
+        return WeightOccupancy(in_name, options.count("stage") ? std::stoi(options["stage"]) : 0);
+    }
+
+    WeightFile file;
+    std::string error;
+    if (command == "unpack" || command == "verify") {
+        if (!file.Open(in_name, error) || !file.Verify(error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (command == "verify") {
+        std::cout << in_name << ": version " << WeightFile::version << ", " << file.StageCount() << " stages of "
+                  << file.Type() << " (" << file.Layout() << "), checksums ok" << std::endl;
+        return 0;
+    }
+
+    if (command == "unpack") {
+        std::ifstream in(in_name, std::ios::in | std::ios::binary);
+        std::vector<char> buffer(WeightFile::chunk_bytes);
+        for (int i = 0; i < file.StageCount(); i++) {
+            std::string stage_name = LegacyStageFileName(out_name, i);
+            std::ofstream out(stage_name, std::ios::out | std::ios::binary);
+            in.seekg(std::streamoff(file.Stage(i).offset));
+            for (uint64_t left = file.Stage(i).bytes; left > 0 && in && out;) {
+                std::streamsize n = std::streamsize(std::min<uint64_t>(left, buffer.size()));
+                in.read(buffer.data(), n);
+                out.write(buffer.data(), n);
+                left -= uint64_t(n);
+            }
+            if (!in || !out) {
+                std::cerr << "failed to write " << stage_name << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    std::cerr << "unknown weight file command: " << command << std::endl;
+    return 1;
+}
@@ -0,0 +1,197 @@
+//
+// Weight files loaded once per process and shared by every agent that names them
+//
+#pragma once
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NTupleNetwork.h"
+#include "WeightFile.h"
+
+/**
+ * a read-only ValueNetwork is kept once per (weight type, placement, file path, file identity): the player and the
+ * environment of one process loading the same file get the same instance
+ * the registry only holds weak references, the agents own the networks, and an agent that learns
+ * takes its own copy before the first update (see TdLambdaPlayer::Writable)
+ * the networks are read-only maps of their files (see ValueNetwork::map)
+ * loads are reported on std::clog, they may happen in the middle of an arena session
+ */
+class WeightRegistry {
+public:
+    /**
+     * stage of the network stored in file_name, or nullptr (after saying why) if it cannot be loaded
+     * file_name is a container (see WeightFile) or a legacy name, whose stage files are weight0.bin, weight1.bin, ...
+     * with the default placement the file is mapped; any other placement needs memory of its own,
+     * so the weights are copied into it (see WeightPlacement)
+     * verify compares the stage checksums of a container, which reads the whole file
+     */
+    static std::shared_ptr<ValueNetwork> Load(const std::string &file_name, int stage, const std::string &type,
+                                              const WeightPlacement &placement = WeightPlacement(),
+                                              bool verify = false) {
+        // the file is opened, checked and mapped without the lock, which only guards the map of networks,
+        // so the load of one stage never waits on the load of another
+        std::string stage_name = WeightFile::IsContainer(file_name) ? file_name : LegacyStageFileName(file_name, stage);
+        std::string path, identity;
+        uint64_t offset;
+        if (!Locate(file_name, stage, type, verify, path, offset, identity)) return nullptr;
+
+        std::stringstream key;
+        key << type << ":" << placement.Name() << ":" << path << ":" << offset << ":" << identity;
+
+        std::shared_ptr<ValueNetwork> network = Find(key.str());
+        if (network) {
+            std::clog << "Sharing " << stage_name << " stage " << stage << std::endl;
+            return network;
+        }
+
+        // mapped read-only, so loading is O(1) and the page cache is shared with other processes;
+        // read into memory where the file cannot be mapped
+        network = std::make_shared<ValueNetwork>(type);
+        network->Place(placement);
+        if (!network->map(path, false, offset)) {
+            std::ifstream load_stream(path.c_str(), std::ios::in | std::ios::binary);
+            load_stream.seekg(std::streamoff(offset));
+
+            network = std::make_shared<ValueNetwork>(type);
+            network->Place(placement);
+            network->load(load_stream);
+            if (!load_stream) {
+                std::cerr << "cannot read " << stage_name << std::endl;
+                return nullptr;
+            }
+        }
+        {
+            // another thread may have loaded the same stage meanwhile, the first one stays
+            std::lock_guard<std::mutex> lock(Mutex());
+            std::weak_ptr<ValueNetwork> &entry = Networks()[key.str()];
+            std::shared_ptr<ValueNetwork> loaded = entry.lock();
+            if (loaded) return loaded;
+            entry = network;
+        }
+        std::clog << stage_name << " stage " << stage << ": " << Describe(network->Backing()) << std::endl;
+
+        return network;
+    }
+
+    /**
+     * whether stage of file_name is there and has the size or layout of a type stage, as Load checks it before
+     * mapping it, so a missing or broken file shows at startup rather than when a game first reaches the stage
+     */
+    static bool Check(const std::string &file_name, int stage, const std::string &type, bool verify = false) {
+        std::string path, identity;
+        uint64_t offset;
+        return Locate(file_name, stage, type, verify, path, offset, identity);
+    }
+
+    /**
+     * resident set size of the process in bytes
+     */
+    static size_t ResidentSetSize() {
+        size_t pages = 0, resident = 0;
+        FILE *statm = std::fopen("/proc/self/statm", "r");
+        if (statm) {
+            if (std::fscanf(statm, "%zu %zu", &pages, &resident) != 2) resident = 0;
+            std::fclose(statm);
+        }
+        return resident * size_t(sysconf(_SC_PAGESIZE));
+    }
+
+    static void ReportMemory(std::ostream &out) {
+        std::lock_guard<std::mutex> lock(Mutex());
+
+        size_t loaded = 0, references = 0;
+        for (auto &entry : Networks()) {
+            if (entry.second.expired()) continue;
+            loaded++;
+            references += entry.second.use_count();
+        }
+        out << "RSS " << ResidentSetSize() / (1024 * 1024) << " MB, "
+            << loaded << " weight files loaded, " << references << " references" << std::endl;
+    }
+
+private:
+    static std::mutex &Mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::map<std::string, std::weak_ptr<ValueNetwork>> &Networks() {
+        static std::map<std::string, std::weak_ptr<ValueNetwork>> networks;
+        return networks;
+    }
+
+    /**
+     * the real path of stage of file_name, the offset of the stage in it and what identifies its content,
+     * or false (after saying why) if it is missing or does not fit type
+     * a container names its stages by their checksums, a legacy file by its inode, size and mtime, so nothing
+     * but the header of a container is read
+     */
+    static bool Locate(const std::string &file_name, int stage, const std::string &type, bool verify,
+                       std::string &path, uint64_t &offset, std::string &identity) {
+        bool container = WeightFile::IsContainer(file_name);
+        std::string stage_name = container ? file_name : LegacyStageFileName(file_name, stage);
+        path = RealPath(stage_name);
+        struct stat st;
+        if (path.empty() || stat(path.c_str(), &st) != 0) {
+            std::cerr << "cannot open " << stage_name << std::endl;
+            return false;
+        }
+
+        offset = 0;
+        if (container) {
+            WeightFile file;
+            std::string error;
+            if (!file.Open(path, error) || !file.Fits(stage, type, error) || (verify && !file.Verify(error))) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+            offset = file.Stage(stage).offset;
+            std::stringstream checksum;
+            checksum << std::hex << file.Stage(stage).checksum;
+            identity = checksum.str();
+        } else {
+            if (ValueNetwork::Bytes(type) && uint64_t(st.st_size) != ValueNetwork::Bytes(type)) {
+                std::cerr << stage_name << " has " << st.st_size << " bytes, a " << type << " stage has "
+                          << ValueNetwork::Bytes(type) << std::endl;
+                return false;
+            }
+            identity = FileIdentity(st);
+        }
+
+        return true;
+    }
+
+    static std::shared_ptr<ValueNetwork> Find(const std::string &key) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        auto it = Networks().find(key);
+        return it != Networks().end() ? it->second.lock() : nullptr;
+    }
+
+    static std::string RealPath(const std::string &file_name) {
+        char path[PATH_MAX];
+        return realpath(file_name.c_str(), path) ? std::string(path) : std::string();
+    }
+
+    /**
+     * device, inode, size and modification time of a file: a file rewritten in place or replaced by a rename gets
+     * a new identity, and nothing is read to tell
+     */
+    static std::string FileIdentity(const struct stat &st) {
+        std::stringstream identity;
+        identity << st.st_dev << ":" << st.st_ino << ":" << st.st_size << ":" << st.st_mtim.tv_sec << "."
+                 << st.st_mtim.tv_nsec;
+        return identity.str();
+    }
+};
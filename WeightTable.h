@@ -0,0 +1,386 @@
+//
+// Memory behind the big weight tables: zero pages from the kernel, or a mapping of the weight file
+//
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Numa.h"
+#include "Weights.h"
+
+/**
+ * a weight file mapped as a whole, kept alive by every table that points into it
+ * read-only mappings are MAP_SHARED, so every process that maps the file reads the same page cache;
+ * writable ones are MAP_PRIVATE, a page is copied the first time it is written and the file never changes
+ */
+class MappedWeightFile {
+public:
+    /**
+     * nullptr if the file cannot be opened or mapped
+     */
+    static std::shared_ptr<MappedWeightFile> Open(const std::string &file_name, bool writable) {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+
+        struct stat st;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            data = mmap(nullptr, size_t(st.st_size), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                        writable ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED) return nullptr;
+
+        return std::shared_ptr<MappedWeightFile>(new MappedWeightFile(static_cast<char *>(data), size_t(st.st_size)));
+    }
+
+    ~MappedWeightFile() {
+        munmap(data_, size_);
+    }
+
+    char *data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+private:
+    MappedWeightFile(char *data, size_t size) : data_(data), size_(size) {}
+
+    MappedWeightFile(const MappedWeightFile &) = delete;
+
+    MappedWeightFile &operator=(const MappedWeightFile &) = delete;
+
+    char *data_;
+    size_t size_;
+};
+
+/**
+ * walks a mapped weight file block by block, the mmap counterpart of the ifstream load() reads
+ * like a stream it fails once a block runs past the end of the file
+ */
+struct WeightCursor {
+    std::shared_ptr<MappedWeightFile> file;
+    size_t offset = 0;
+    bool failed = false;
+    bool copy = false; // tables copy their blocks into their own memory instead of pointing into the file
+
+    explicit WeightCursor(std::shared_ptr<MappedWeightFile> file) : file(std::move(file)) {}
+
+    /**
+     * the next bytes of the file, or nullptr past its end
+     */
+    char *Take(size_t bytes) {
+        if (failed || offset + bytes > file->size()) {
+            failed = true;
+            return nullptr;
+        }
+        char *data = file->data() + offset;
+        offset += bytes;
+        return data;
+    }
+
+    void Read(void *out, size_t bytes) {
+        char *data = Take(bytes);
+        if (data) std::memcpy(out, data, bytes);
+    }
+
+    explicit operator bool() const { return !failed; }
+};
+
+/**
+ * the memory the owned weight tables are allocated in
+ * the tables are read at random, so with 4 KB pages nearly every lookup of a search misses the TLB;
+ * 2 MB pages cover a 256 MB table with 128 entries
+ *   pages: "4k" (default), "thp" (transparent huge pages, madvise), "hugetlb" (explicit huge pages from
+ *          the reserved pool, falling back to thp when the pool is empty)
+ *   interleave: spread the pages round-robin over all NUMA nodes, so no node's memory bus serves every lookup
+ *   replicate: keep a copy of every read-only network on each NUMA node, and read the copy of the node the
+ *              searching thread runs on (see StageNetworks); node is the node of one such copy
+ */
+struct WeightPlacement {
+    std::string pages = "4k";
+    bool interleave = false;
+    bool replicate = false;
+    int node = -1;
+
+    bool Default() const { return pages == "4k" && !interleave && node < 0; }
+
+    std::string Name() const {
+        return pages + (interleave ? "+interleave" : "") + (node >= 0 ? "+node" + std::to_string(node) : "");
+    }
+};
+
+/**
+ * bytes of the weight tables of a network by the backing they actually got, see WeightTable::Backing
+ */
+typedef std::map<std::string, size_t> WeightBacking;
+
+static std::string Describe(const WeightBacking &backing) {
+    std::stringstream out;
+    for (auto &entry : backing) {
+        if (out.tellp() > 0) out << ", ";
+        if (entry.second >= 1024 * 1024) {
+            out << entry.second / (1024 * 1024) << " MB " << entry.first;
+        } else {
+            out << (entry.second + 1023) / 1024 << " KB " << entry.first;
+        }
+    }
+    return out.str();
+}
+
+/**
+ * the memory of some weight tables: bytes by the backing they got, and how many of them are resident
+ */
+struct WeightMemory {
+    WeightBacking backing;
+    size_t resident = 0;
+
+    size_t Bytes() const {
+        size_t bytes = 0;
+        for (auto &entry : backing) bytes += entry.second;
+        return bytes;
+    }
+};
+
+/**
+ * n weights, either owned or pointing into a mapped weight file
+ * owned tables are anonymous mappings: the kernel hands out zero pages as they are first touched,
+ * so a new table costs nothing until it is written
+ */
+template<typename Weight>
+class WeightTable {
+public:
+    explicit WeightTable(size_t n) : size_(n) {
+        Allocate();
+    }
+
+    // a copy always owns its weights, in the same placement
+    WeightTable(const WeightTable &table) : size_(table.size_), placement_(table.placement_) {
+        Allocate();
+        if (size_) std::memcpy(data_, table.data_, size_ * sizeof(Weight));
+    }
+
+    WeightTable(WeightTable &&table) : data_(table.data_), size_(table.size_), mapped_bytes_(table.mapped_bytes_),
+                                       hugetlb_(table.hugetlb_), placement_(table.placement_),
+                                       file_(std::move(table.file_)) {
+        table.data_ = nullptr;
+    }
+
+    WeightTable &operator=(const WeightTable &) = delete;
+
+    ~WeightTable() {
+        Release();
+    }
+
+    Weight &operator[](size_t i) { return data_[i]; }
+
+    void Update(size_t i, float delta) { UpdateWeight(data_[i], delta); }
+
+    const Weight &operator[](size_t i) const { return data_[i]; }
+
+    void Prefetch(size_t i) const { __builtin_prefetch(data_ + i); }
+
+    Weight *data() { return data_; }
+
+    size_t size() const { return size_; }
+
+    /**
+     * point the table at the next block of the file instead of its own memory, nothing is read
+     * (or copy the block, if the cursor says so)
+     */
+    void Map(WeightCursor &in) {
+        Weight *data = reinterpret_cast<Weight *>(in.Take(size_ * sizeof(Weight)));
+        if (!data) return;
+        if (in.copy) {
+            std::memcpy(data_, data, size_ * sizeof(Weight));
+            return;
+        }
+
+        Release();
+        data_ = data;
+        file_ = in.file;
+    }
+
+    /**
+     * drop the weights and start over with n zero weights in owned memory
+     */
+    void Reset(size_t n) {
+        Release();
+        file_.reset();
+        size_ = n;
+        Allocate();
+    }
+
+    /**
+     * move a new table to the memory described by placement, before any weight is loaded into it
+     * (its weights are zero, so nothing is copied); mapped tables stay where they are
+     */
+    void Place(const WeightPlacement &placement) {
+        if (file_) return;
+
+        Release();
+        placement_ = placement;
+        Allocate();
+    }
+
+    /**
+     * add the bytes of the table under the backing it got: "file", "hugetlb", "4k", or for thp the share
+     * the kernel actually backed with huge pages, as read from /proc/self/smaps
+     */
+    void Backing(WeightBacking &backing) const {
+        size_t bytes = size_ * sizeof(Weight);
+        if (file_) {
+            backing["file"] += bytes;
+        } else if (hugetlb_) {
+            backing["hugetlb"] += bytes;
+        } else if (placement_.pages == "4k") {
+            backing["4k"] += bytes;
+        } else {
+            size_t huge = std::min(bytes, AnonHugeBytes());
+            backing["thp"] += huge;
+            if (bytes > huge) backing["4k"] += bytes - huge;
+        }
+    }
+
+    void Memory(WeightMemory &memory) const {
+        Backing(memory.backing);
+        memory.resident += Resident();
+    }
+
+    /**
+     * bytes of the table in memory, from mincore: touched pages of an owned table, cached pages of a mapped file
+     */
+    size_t Resident() const {
+        if (!data_) return 0;
+        size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+        uintptr_t first = reinterpret_cast<uintptr_t>(data_) & ~(page_size - 1);
+        uintptr_t last = reinterpret_cast<uintptr_t>(data_) + size_ * sizeof(Weight);
+        std::vector<unsigned char> pages((last - first + page_size - 1) / page_size);
+        if (mincore(reinterpret_cast<void *>(first), last - first, pages.data()) != 0) return 0;
+
+        size_t resident = 0;
+        for (unsigned char page : pages) resident += page & 1;
+        return std::min(resident * page_size, size_ * sizeof(Weight));
+    }
+
+private:
+    static const size_t huge_page_size = 2 * 1024 * 1024;
+
+    void Allocate() {
+        size_t bytes = size_ * sizeof(Weight);
+        void *data = MAP_FAILED;
+        hugetlb_ = false;
+        if (bytes == 0) {
+            data_ = nullptr;
+            return;
+        }
+
+        if (placement_.pages == "hugetlb") {
+            mapped_bytes_ = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+            data = mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            hugetlb_ = data != MAP_FAILED;
+        }
+
+        if (data == MAP_FAILED && placement_.pages != "4k") {
+            // a 2 MB aligned range, so every full 2 MB of the table can become one huge page
+            mapped_bytes_ = bytes + huge_page_size;
+            char *raw = static_cast<char *>(mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE,
+                                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (raw != MAP_FAILED) {
+                char *aligned = reinterpret_cast<char *>(
+                        (reinterpret_cast<uintptr_t>(raw) + huge_page_size - 1) & ~(huge_page_size - 1));
+                if (aligned > raw) munmap(raw, aligned - raw);
+                munmap(aligned + bytes, raw + mapped_bytes_ - aligned - bytes);
+                mapped_bytes_ = bytes;
+                madvise(aligned, bytes, MADV_HUGEPAGE);
+                data = aligned;
+            }
+        }
+
+        if (data == MAP_FAILED) {
+            mapped_bytes_ = bytes;
+            data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if (data == MAP_FAILED) throw std::bad_alloc();
+
+        if (placement_.interleave && (NumaNodeMask() & (NumaNodeMask() - 1))) {
+            // mbind(MPOL_INTERLEAVE), called directly so there is no libnuma to link
+            unsigned long nodes = NumaNodeMask();
+            syscall(SYS_mbind, data, mapped_bytes_, 3, &nodes, sizeof(nodes) * 8, 0);
+        }
+        if (placement_.node >= 0 && placement_.node < 64 && NumaNodes().size() > 1) {
+            // mbind(MPOL_PREFERRED): on the node of the copy, on another one when it is full
+            unsigned long nodes = 1UL << placement_.node;
+            syscall(SYS_mbind, data, mapped_bytes_, 1, &nodes, sizeof(nodes) * 8, 0);
+        }
+
+        data_ = static_cast<Weight *>(data);
+    }
+
+    void Release() {
+        if (data_ && !file_) munmap(data_, mapped_bytes_);
+    }
+
+    /**
+     * bytes of the table that sit on transparent huge pages
+     * smaps counts them per mapping, and neighbouring tables may share one, so a mapping's count is split
+     * by how much of it the table covers
+     */
+    size_t AnonHugeBytes() const {
+        std::ifstream smaps("/proc/self/smaps");
+        unsigned long first = reinterpret_cast<uintptr_t>(data_), last = first + size_ * sizeof(Weight);
+        double overlap = 0, total = 0;
+
+        for (std::string line; std::getline(smaps, line);) {
+            unsigned long begin, end;
+            if (std::sscanf(line.c_str(), "%lx-%lx ", &begin, &end) == 2) {
+                overlap = begin < last && first < end
+                          ? double(std::min(end, last) - std::max(begin, first)) / (end - begin) : 0;
+            } else if (overlap > 0 && line.compare(0, 14, "AnonHugePages:") == 0) {
+                total += overlap * std::stoull(line.substr(14)) * 1024;
+            }
+        }
+        return size_t(total);
+    }
+
+    Weight *data_;
+    size_t size_;
+    size_t mapped_bytes_ = 0;
+    bool hugetlb_ = false;
+    WeightPlacement placement_;
+    std::shared_ptr<MappedWeightFile> file_;
+};
+
+template<typename Weight>
+static void SaveWeights(std::ofstream &out, WeightTable<Weight> &table, float scale) {
+    SaveWeights(out, table.data(), table.size(), scale);
+}
+
+template<typename Weight>
+static void LoadWeights(std::ifstream &in, WeightTable<Weight> &table, float &scale) {
+    LoadWeights(in, table.data(), table.size(), scale);
+}
+
+/**
+ * the mapped counterpart of LoadWeights
+ */
+template<typename Weight>
+static void MapWeights(WeightCursor &in, WeightTable<Weight> &table, float &scale) {
+    scale = 1.0f;
+    if (WeightTraits<Weight>::quantized) {
+        in.Read(&scale, sizeof(scale));
+    }
+    table.Map(in);
+}
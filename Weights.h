@@ -0,0 +1,246 @@
+//
+// Storage types of the n-tuple weights: float as trained, int16 or fp16 for inference
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <immintrin.h>
+#include <iostream>
+#include <vector>
+
+#include "Common.h"
+
+/**
+ * IEEE 754 half precision weight, kept as its raw bits
+ */
+struct Half {
+    uint16_t bits;
+};
+
+/**
+ * exact for every half, inf and nan excepted (the converter never writes them):
+ * shifting the exponent and mantissa into float position and scaling by 2^(127-15) rebiases the exponent,
+ * and also gives the right value for subnormal halves
+ */
+static float HalfToFloat(uint16_t bits) {
+    uint32_t magnitude = uint32_t(bits & 0x7FFF) << 13;
+    float value;
+    std::memcpy(&value, &magnitude, sizeof(value));
+    value *= 5.192296858534828e+33f; // 2^112
+
+    return (bits & 0x8000) ? -value : value;
+}
+
+/**
+ * round to nearest even, |value| has to be at most 65504
+ */
+static uint16_t FloatToHalf(float value) {
+    uint16_t sign = std::signbit(value) ? 0x8000 : 0;
+    float scaled = std::fabs(value) * 1.925929944387236e-34f; // 2^-112
+    uint32_t bits;
+    std::memcpy(&bits, &scaled, sizeof(bits));
+
+    bits += 0x0FFF + ((bits >> 13) & 1);
+    return uint16_t(sign | (bits >> 13));
+}
+
+/**
+ * fp16 weights are widened with F16C where the host has it, checked once at runtime
+ */
+static bool HasF16c() {
+    static const bool has_f16c = __builtin_cpu_supports("f16c");
+    return has_f16c;
+}
+
+__attribute__((target("f16c")))
+static float SumHalvesF16c(const uint16_t *bits, int n) {
+    float total_value = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 values = _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(bits + i)));
+        values = _mm_add_ps(values, _mm_movehl_ps(values, values));
+        total_value += _mm_cvtss_f32(_mm_add_ss(values, _mm_shuffle_ps(values, values, 1)));
+    }
+    for (; i < n; i++) total_value += _cvtsh_ss(bits[i]);
+    return total_value;
+}
+
+/**
+ * the sum in the order SumHalvesF16c adds, (w0 + w2) + (w1 + w3) for each 4 weights, so evaluations (and the
+ * moves they pick on ties) are the same on hosts with and without F16C
+ */
+static float SumHalves(const uint16_t *bits, int n) {
+    if (HasF16c()) return SumHalvesF16c(bits, n);
+
+    float total_value = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        total_value += (HalfToFloat(bits[i]) + HalfToFloat(bits[i + 2]))
+                       + (HalfToFloat(bits[i + 1]) + HalfToFloat(bits[i + 3]));
+    }
+    for (; i < n; i++) total_value += HalfToFloat(bits[i]);
+    return total_value;
+}
+
+/**
+ * how a stored weight maps to its value: value = Dequantize(w) * scale, with one scale per table
+ * float tables have no scale and are saved exactly as before, the quantized ones save the scale first
+ */
+template<typename Weight>
+struct WeightTraits;
+
+template<>
+struct WeightTraits<float> {
+    typedef float Value; // what a table lookup returns, and WeightSum adds
+
+    static const bool quantized = false;
+
+    static const char *Name() { return "float"; }
+
+    static float Dequantize(float w) { return w; }
+};
+
+template<>
+struct WeightTraits<int16_t> {
+    typedef int16_t Value;
+
+    static const bool quantized = true;
+
+    static const char *Name() { return "int16"; }
+
+    static float Dequantize(int16_t w) { return w; }
+
+    // the largest weight maps to +-32767
+    static float Scale(float max_abs) { return max_abs > 0 ? max_abs / 32767.0f : 1.0f; }
+
+    static int16_t Quantize(float v) { return int16_t(std::max(-32767.0f, std::min(32767.0f, std::nearbyint(v)))); }
+};
+
+template<>
+struct WeightTraits<Half> {
+    typedef Half Value;
+
+    static const bool quantized = true;
+
+    static const char *Name() { return "fp16"; }
+
+    static float Dequantize(Half w) { return HalfToFloat(w.bits); }
+
+    // fp16 keeps its relative precision over the whole range, so the scale only guards against overflow
+    static float Scale(float max_abs) { return std::max(1.0f, max_abs / 65504.0f); }
+
+    static Half Quantize(float v) { return Half{FloatToHalf(std::max(-65504.0f, std::min(65504.0f, v)))}; }
+};
+
+/**
+ * the sum of the weights a feature reads from its two tables
+ * float weights are added in the order they come, as always; quantized weights are summed per table
+ * and scaled once at the end, for int16 in exact integer arithmetic
+ */
+template<typename Weight>
+struct WeightSum;
+
+template<>
+struct WeightSum<float> {
+    float total_value = 0;
+
+    void Add(int table, float w) { total_value += w; }
+
+    float Value(const float *scale) const { return total_value; }
+};
+
+/**
+ * halves are collected per table and widened together
+ */
+template<>
+struct WeightSum<Half> {
+    uint16_t bits[2][16];
+    int count[2] = {0, 0};
+
+    void Add(int table, Half w) { bits[table][count[table]++] = w.bits; }
+
+    float Value(const float *scale) const {
+        return SumHalves(bits[0], count[0]) * scale[0] + SumHalves(bits[1], count[1]) * scale[1];
+    }
+};
+
+template<>
+struct WeightSum<int16_t> {
+    int32_t sum[2] = {0, 0};
+
+    void Add(int table, int16_t w) { sum[table] += w; }
+
+    float Value(const float *scale) const { return float(sum[0]) * scale[0] + float(sum[1]) * scale[1]; }
+};
+
+static void UpdateWeight(float &w, float delta) {
+    w += delta;
+}
+
+/**
+ * quantized weights are for inference only
+ */
+template<typename Weight>
+static void UpdateWeight(Weight &w, float delta) {
+    std::cerr << WeightTraits<Weight>::Name() << " weights are inference-only and cannot be updated" << std::endl;
+    std::exit(-1);
+}
+
+/**
+ * bytes one table of n weights takes in a weight file, the scale of a quantized table included
+ */
+template<typename Weight>
+static size_t TableBytes(size_t n) {
+    return n * sizeof(Weight) + (WeightTraits<Weight>::quantized ? sizeof(float) : 0);
+}
+
+template<typename Weight>
+static void SaveWeights(std::ofstream &out, const Weight *table, size_t n, float scale) {
+    if (WeightTraits<Weight>::quantized) {
+        out.write(reinterpret_cast<const char *>(&scale), sizeof(scale));
+    }
+    out.write(reinterpret_cast<const char *>(table), n * sizeof(Weight));
+}
+
+template<typename Weight>
+static void LoadWeights(std::ifstream &in, Weight *table, size_t n, float &scale) {
+    scale = 1.0f;
+    if (WeightTraits<Weight>::quantized) {
+        in.read(reinterpret_cast<char *>(&scale), sizeof(scale));
+    }
+    in.read(reinterpret_cast<char *>(table), n * sizeof(Weight));
+}
+
+/**
+ * read n float weights from a float weight file and write them as one quantized table
+ */
+template<typename Weight>
+static void QuantizeWeights(std::ifstream &in, std::ofstream &out, size_t n) {
+    std::vector<float> values(n);
+    in.read(reinterpret_cast<char *>(&values[0]), n * sizeof(float));
+
+    float max_abs = 0;
+    for (float v : values) max_abs = std::max(max_abs, std::fabs(v));
+    float scale = WeightTraits<Weight>::Scale(max_abs);
+
+    std::vector<Weight> table(n);
+    for (size_t i = 0; i < n; i++) {
+        table[i] = WeightTraits<Weight>::Quantize(values[i] / scale);
+    }
+
+    SaveWeights(out, &table[0], n, scale);
+}
+
+/**
+ * copy a block that is kept in float as it is
+ */
+static void CopyWeights(std::ifstream &in, std::ofstream &out, size_t n) {
+    std::vector<float> values(n);
+    in.read(reinterpret_cast<char *>(&values[0]), n * sizeof(float));
+    out.write(reinterpret_cast<const char *>(&values[0]), n * sizeof(float));
+}